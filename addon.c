@@ -1,8 +1,12 @@
+#define _GNU_SOURCE /* fopencookie() */
 #include <math.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include "awk.h"
 
 int bio_flag = 0, bio_fmt = BIO_NULL;
@@ -115,6 +119,10 @@ static float q_int2real[128];
 
 #define tempfree(x)	  if (istemp(x)) tfree(x); else
 
+static double bio_loadtab(const char *fn, Cell *ap, int kc, int vc);
+static int bio_kwmatch(const char *s, Cell *keys, Cell *hits, int *len);
+static void bio_sorted(const char *fn, const char *keys, const char *mem);
+
 Cell *bio_func(int f, Cell *x, Node **a)
 {
 	Cell *y, *z;
@@ -152,7 +160,7 @@ Cell *bio_func(int f, Cell *x, Node **a)
 		l = strlen(buf);
 		for (i = 0; i < l>>1; ++i)
 			tmp = buf[i], buf[i] = buf[l-1-i], buf[l-1-i] = tmp;
-		setsval(y, buf);
+		memcpy(tempsval(y, l), buf, l);
 	} else if (f == BIO_FREVCOMP) {
 		char *buf;
 		int i, l, tmp;
@@ -161,7 +169,7 @@ Cell *bio_func(int f, Cell *x, Node **a)
 		for (i = 0; i < l>>1; ++i)
 			tmp = comp_tab[(int)buf[i]], buf[i] = comp_tab[(int)buf[l-1-i]], buf[l-1-i] = tmp;
 		if (l&1) buf[l>>1] = comp_tab[(int)buf[l>>1]];
-		setsval(y, buf);
+		memcpy(tempsval(y, l), buf, l);
 	} else if (f == BIO_FGC) {
 		char *buf;
 		int i, l, gc = 0;
@@ -230,6 +238,100 @@ Cell *bio_func(int f, Cell *x, Node **a)
 				if (buf[i] - 33 >= thres) ++cnt;
 			setfval(y, (Awkfloat)cnt);
 		}
+	} else if (f == BIO_FDUMP) { /* dump(arr, file) */
+		if (a[1]->nnext == 0) {
+			WARNING("dump requires two arguments; returning 0.0");
+			setfval(y, 0.0);
+		} else {
+			if (!isarr(x)) FATAL("can't dump %s: not an array", NN(x->nval));
+			z = execute(a[1]->nnext);
+			setfval(y, (Awkfloat)dumparray((Array*)x->sval, getsval(z)));
+			tempfree(z);
+		}
+	} else if (f == BIO_FATTACH) { /* attach(file, arr); -1 if file can't be opened */
+		if (a[1]->nnext == 0) {
+			WARNING("attach requires two arguments; returning 0.0");
+			setfval(y, 0.0);
+		} else {
+			z = execute(a[1]->nnext);
+			setfval(y, (Awkfloat)attacharray(z, getsval(x)));
+			tempfree(z);
+		}
+	} else if (f == BIO_FLOADTAB) { /* loadtab(file, arr, keycol[, valcol]); -1 if file can't be opened */
+		if (a[1]->nnext == 0 || a[1]->nnext->nnext == 0) {
+			WARNING("loadtab requires at least three arguments; returning 0.0");
+			setfval(y, 0.0);
+		} else {
+			Cell *u, *v = 0;
+			z = execute(a[1]->nnext); /* array */
+			u = execute(a[1]->nnext->nnext); /* key column */
+			if (a[1]->nnext->nnext->nnext)
+				v = execute(a[1]->nnext->nnext->nnext); /* value column; default $0 */
+			setfval(y, bio_loadtab(getsval(x), z, (int)getfval(u), v? (int)getfval(v) : 0));
+			tempfree(z);
+			tempfree(u);
+			if (v) { tempfree(v); }
+		}
+	} else if (f == BIO_FLRU) { /* lru(arr, n[, "fname"]): keep the n most recently used */
+		if (a[1]->nnext == 0) {
+			WARNING("lru requires at least two arguments; returning 0.0");
+			setfval(y, 0.0);
+		} else {
+			Cell *u = 0, *fcn = 0;
+			z = execute(a[1]->nnext); /* n */
+			if (a[1]->nnext->nnext) {
+				u = execute(a[1]->nnext->nnext); /* function name */
+				fcn = lookup(getsval(u), symtab);
+				if (fcn == 0 || !isfcn(fcn))
+					FATAL("lru: %s is not a function", getsval(u));
+			}
+			lruarray(x, (int)getfval(z), fcn);
+			setfval(y, getfval(z));
+			tempfree(z);
+			if (u) { tempfree(u); }
+		}
+	} else if (f == BIO_FASORT || f == BIO_FASORTI) { /* asort(src[, dest[, "how"]]): dest[1..n] = values (asorti: keys) in order */
+		Cell *u = 0;
+		z = 0;
+		if (a[1]->nnext) {
+			z = execute(a[1]->nnext); /* dest; default src itself */
+			if (a[1]->nnext->nnext)
+				u = execute(a[1]->nnext->nnext); /* order or function name */
+		}
+		setfval(y, asortarray(x, z? z : x, u? getsval(u) : 0, f == BIO_FASORTI));
+		if (z) { tempfree(z); }
+		if (u) { tempfree(u); }
+	} else if (f == BIO_FSORTED) { /* print > sorted(file, "1,2n"[, mem]): file, sorted at close() */
+		if (a[1]->nnext == 0) {
+			WARNING("sorted requires at least two arguments");
+			setsval(y, getsval(x));
+		} else {
+			Cell *u = 0;
+			z = execute(a[1]->nnext); /* keys */
+			if (a[1]->nnext->nnext)
+				u = execute(a[1]->nnext->nnext); /* memory to use */
+			bio_sorted(getsval(x), getsval(z), u? getsval(u) : 0);
+			setsval(y, getsval(x));
+			tempfree(z);
+			if (u) { tempfree(u); }
+		}
+	} else if (f == BIO_FKWMATCH) { /* kwmatch(s, keys[, hits]): where the leftmost-longest keyword starts */
+		if (a[1]->nnext == 0) {
+			WARNING("kwmatch requires at least two arguments; returning 0.0");
+			setfval(y, 0.0);
+		} else {
+			Cell *u = 0;
+			int beg, len;
+			z = execute(a[1]->nnext); /* array or file of keywords */
+			if (a[1]->nnext->nnext)
+				u = execute(a[1]->nnext->nnext); /* every match goes here */
+			beg = bio_kwmatch(getsval(x), z, u, &len);
+			setfval(rstartloc, (Awkfloat)beg);
+			setfval(rlengthloc, (Awkfloat)len);
+			setfval(y, (Awkfloat)beg);
+			tempfree(z);
+			if (u) { tempfree(u); }
+		}
 	} /* else: never happens */
 	return y;
 }
@@ -280,6 +382,7 @@ getrec_start:
 	if (isrecord) {
 		donefld = 0; /* these are defined in lib.c */
 		donerec = 1;
+		recgen++;
 	}
 	saveb0 = buf[0];
 	buf[0] = 0; /* this is effective at the end of file */
@@ -342,10 +445,8 @@ getrec_start:
 					xfree(fldtab[0]->sval);
 				fldtab[0]->sval = buf;	/* buf == record */
 				fldtab[0]->tval = REC | STR | DONTFREE;
-				if (is_number(fldtab[0]->sval)) {
-					fldtab[0]->fval = atof(fldtab[0]->sval);
+				if (is_valid_number(fldtab[0]->sval, &fldtab[0]->fval))
 					fldtab[0]->tval |= NUM;
-				}
 			}
 			setfval(nrloc, nrloc->fval+1);
 			setfval(fnrloc, fnrloc->fval+1);
@@ -366,3 +467,752 @@ getrec_start:
 	*psize = savesize;
 	return 0;	/* true end of file */
 }
+
+/*********************
+ * loadtab() builtin *
+ *********************/
+
+static char *bio_col(char *s, int sep, int c, int *len) /* column c>=1 of s, split at sep (0: blank runs) */
+{
+	char *p = s, *q;
+	int i;
+	if (sep == 0) {
+		for (i = 1;; ++i) {
+			while (*p == ' ' || *p == '\t' || *p == '\n') ++p;
+			if (*p == 0) return 0;
+			for (q = p; *q && *q != ' ' && *q != '\t' && *q != '\n'; ++q);
+			if (i == c) { *len = q - p; return p; }
+			p = q;
+		}
+	}
+	for (i = 1; i < c; ++i) {
+		if ((p = strchr(p, sep)) == 0) return 0;
+		++p;
+	}
+	*len = (q = strchr(p, sep)) != 0? q - p : (int)strlen(p);
+	return p;
+}
+
+static double bio_loadtab(const char *fn, Cell *ap, int kc, int vc) /* lines stored, or -1 if fn can't be opened */
+{
+	gzFile fp;
+	kstream_t *ks;
+	kstring_t str = {0, 0, 0}, key = {0, 0, 0};
+	Array *tp;
+	Cell *p;
+	char *k, *v;
+	int sep, kl, vl, dret, from;
+	long n = 0, bytes = 0;
+	struct stat st;
+
+	if (kc < 0 || vc < 0) FATAL("loadtab: negative column number");
+	if (strcmp(fn, "-") == 0) fp = gzdopen(dup(fileno(stdin)), "r");
+	else fp = gzopen(fn, "r");
+	if (fp == 0) return -1;
+	if (!isarr(ap)) { /* as in split() */
+		if (freeable(ap)) xfree(ap->sval);
+		ap->tval &= ~(STR|NUM|DONTFREE|CONV);
+		ap->tval |= ARR;
+		ap->sval = (char*)makesymtab(NSYMTAB);
+	}
+	tp = (Array*)ap->sval;
+	from = tp->nused; /* -M may spill what we add, but nothing older */
+	sep = strlen(*FS) == 1 && **FS != ' '? **FS : **FS == ' ' && (*FS)[1] == 0? 0 : '\t';
+	ks = ks_init(fp);
+	while (ks_getuntil(ks, '\n', &str, &dret) >= 0) {
+		bytes += str.l + 1;
+		if (str.l == 0) continue; /* blank: no columns, whatever FS is */
+		if (kc == 0) k = str.s, kl = str.l;
+		else if ((k = bio_col(str.s, sep, kc, &kl)) == 0) continue; /* no such column */
+		if (key.m < kl + 1) {
+			key.m = kl + 1; kroundup32(key.m);
+			key.s = (char*)realloc(key.s, key.m);
+		}
+		memcpy(key.s, k, kl); key.s[kl] = 0;
+		if (vc == 0) v = str.s;
+		else if ((v = bio_col(str.s, sep, vc, &vl)) == 0) v = "";
+		else v[vl] = 0;
+		p = setsymtab(key.s, "", 0.0, STR|NUM, tp);
+		setsval(p, v);
+		if (is_valid_number(p->sval, &p->fval)) p->tval |= NUM;
+		if ((++n & 1023) == 0 && arraybudget > 0) arrayfilling(tp, from);
+		else if (n == 1024 && gzdirect(fp) && stat(fn, &st) == 0) { /* plain file: guess the rest and make room */
+			double rest = (double)st.st_size / bytes * n - n;
+			arrayreserve(tp, rest < (1<<28)? (int)rest : 1<<28);
+		}
+	}
+	ks_destroy(ks);
+	gzclose(fp);
+	free(str.s); free(key.s);
+	return (double)n;
+}
+
+/*********************
+ * kwmatch() builtin *
+ *********************/
+
+/* The keywords, an array's indices or the lines of a file, are compiled
+ * into an Aho-Corasick automaton the first time they are seen, and it is
+ * kept while they don't change (Array.gen). Bytes are mapped to classes
+ * first, a class for each byte some keyword uses and one for the rest, so
+ * that the failure links can be folded into a full DFA: a byte of s costs
+ * one table load, however many keywords there are. */
+
+#define KW_CACHE 8 /* automata kept */
+
+typedef struct kwac_s {
+	Array *tp;               /* keys from this array as of gen, or... */
+	unsigned long long gen;
+	char *fn;                /* ...from this file */
+	int n_cls, n_node, max_len;
+	unsigned char cls[256];  /* byte -> class; 0 if in no keyword */
+	int *go;                 /* go[u*n_cls+c]: state after class c in state u */
+	int *len;                /* length of the keyword ending at u, or 0 */
+	int *out;                /* u or the nearest state on its failure chain with a keyword, or -1 */
+	int *fail;
+	struct kwac_s *next;
+} kwac_t;
+
+static kwac_t *kw_list;
+
+static void kw_destroy(kwac_t *ac)
+{
+	free(ac->go); free(ac->len); free(ac->out); free(ac->fail); free(ac->fn); free(ac);
+}
+
+static kwac_t *kw_build(char **kw, int n)
+{
+	kwac_t *ac;
+	int i, j, c, u, v, h, t, m, *q;
+
+	ac = (kwac_t*)calloc(1, sizeof(kwac_t));
+	for (i = 0; i < n; ++i) /* classes */
+		for (j = 0; kw[i][j]; ++j) ac->cls[(unsigned char)kw[i][j]] = 1;
+	for (c = 0, ac->n_cls = 1; c < 256; ++c)
+		if (ac->cls[c]) ac->cls[c] = ac->n_cls++;
+	m = 256; /* the trie; -1 for no edge */
+	ac->go = (int*)malloc(m * ac->n_cls * sizeof(int));
+	ac->len = (int*)calloc(m, sizeof(int));
+	if (ac->go == 0 || ac->len == 0) FATAL("out of space for kwmatch");
+	for (c = 0; c < ac->n_cls; ++c) ac->go[c] = -1;
+	ac->n_node = 1;
+	for (i = 0; i < n; ++i) {
+		for (j = 0, u = 0; kw[i][j]; ++j) {
+			c = ac->cls[(unsigned char)kw[i][j]];
+			if (ac->go[u * ac->n_cls + c] < 0) {
+				if (ac->n_node == m) {
+					m <<= 1;
+					ac->go = (int*)realloc(ac->go, m * ac->n_cls * sizeof(int));
+					ac->len = (int*)realloc(ac->len, m * sizeof(int));
+					if (ac->go == 0 || ac->len == 0) FATAL("out of space for kwmatch");
+				}
+				for (c = 0; c < ac->n_cls; ++c) ac->go[ac->n_node * ac->n_cls + c] = -1;
+				ac->len[ac->n_node] = 0;
+				c = ac->cls[(unsigned char)kw[i][j]];
+				ac->go[u * ac->n_cls + c] = ac->n_node++;
+			}
+			u = ac->go[u * ac->n_cls + c];
+		}
+		if (j > 0) ac->len[u] = j;
+		if (j > ac->max_len) ac->max_len = j;
+	}
+	ac->fail = (int*)malloc(ac->n_node * sizeof(int));
+	ac->out = (int*)malloc(ac->n_node * sizeof(int));
+	q = (int*)malloc(ac->n_node * sizeof(int));
+	if (ac->fail == 0 || ac->out == 0 || q == 0) FATAL("out of space for kwmatch");
+	ac->fail[0] = 0, ac->out[0] = -1;
+	for (c = h = t = 0; c < ac->n_cls; ++c) { /* breadth first, folding failures into go[] */
+		if ((v = ac->go[c]) < 0) ac->go[c] = 0;
+		else ac->fail[v] = 0, q[t++] = v;
+	}
+	while (h < t) {
+		u = q[h++];
+		ac->out[u] = ac->len[u]? u : ac->out[ac->fail[u]];
+		for (c = 0; c < ac->n_cls; ++c) {
+			int f = ac->go[ac->fail[u] * ac->n_cls + c];
+			if ((v = ac->go[u * ac->n_cls + c]) < 0) ac->go[u * ac->n_cls + c] = f;
+			else ac->fail[v] = f, q[t++] = v;
+		}
+	}
+	free(q);
+	return ac;
+}
+
+static kwac_t *kw_get(Cell *keys) /* the automaton for keys, built if need be */
+{
+	kwac_t *ac, **pp;
+	Array *tp = isarr(keys)? (Array*)keys->sval : 0;
+	char *fn = tp? 0 : getsval(keys), **kw = 0;
+	int i, n = 0, m = 0;
+
+	for (pp = &kw_list, i = 0; (ac = *pp) != 0; pp = &ac->next, ++i) {
+		if (tp? ac->tp == tp : ac->fn && strcmp(ac->fn, fn) == 0) {
+			*pp = ac->next;
+			if (tp && ac->gen != tp->gen) { kw_destroy(ac); break; } /* keys changed */
+			ac->next = kw_list, kw_list = ac; /* to the front */
+			return ac;
+		}
+		if (i == KW_CACHE - 1 && ac->next) { /* drop the least recently used */
+			kw_destroy(ac->next);
+			ac->next = 0;
+		}
+	}
+	if (tp) {
+		Asort *as = sortarray(tp, "@unsorted", 0);
+		kw = (char**)malloc((as->n + 1) * sizeof(char*));
+		for (i = 0; i < as->n; ++i)
+			if (*as->item[i].k) kw[n++] = as->item[i].k;
+		ac = kw_build(kw, n);
+		freesort(as);
+		ac->tp = tp, ac->gen = tp->gen;
+	} else {
+		gzFile fp;
+		kstream_t *ks;
+		kstring_t str = {0, 0, 0};
+		int dret;
+		if (strcmp(fn, "-") == 0) fp = gzdopen(dup(fileno(stdin)), "r");
+		else fp = gzopen(fn, "r");
+		if (fp == 0) FATAL("kwmatch: can't open file %s", fn);
+		ks = ks_init(fp);
+		while (ks_getuntil(ks, '\n', &str, &dret) >= 0) {
+			if (str.l == 0) continue;
+			if (n == m) {
+				m = m? m<<1 : 256;
+				kw = (char**)realloc(kw, m * sizeof(char*));
+			}
+			kw[n++] = tostring(str.s);
+		}
+		ks_destroy(ks);
+		gzclose(fp);
+		free(str.s);
+		ac = kw_build(kw, n);
+		for (i = 0; i < n; ++i) free(kw[i]);
+		ac->fn = tostring(fn);
+	}
+	free(kw);
+	ac->next = kw_list, kw_list = ac;
+	return ac;
+}
+
+static int bio_kwmatch(const char *s, Cell *keys, Cell *hits, int *len)
+{
+	kwac_t *ac = kw_get(keys);
+	const unsigned char *p = (const unsigned char*)s;
+	int i, u, w, beg = -1, st;
+	Array *tp = 0;
+	char idx[16], *k = 0;
+
+	*len = -1;
+	if (hits) { /* as in split() */
+		freesymtab(hits);
+		hits->tval &= ~(STR|NUM|DONTFREE|CONV);
+		hits->tval |= ARR;
+		hits->sval = (char*)(tp = makesymtab(NSYMTAB));
+		k = (char*)malloc(ac->max_len + 1);
+	}
+	for (i = u = 0; p[i]; ++i) {
+		if (beg >= 0 && tp == 0 && i >= beg + ac->max_len) break; /* nothing can start further left */
+		u = ac->go[u * ac->n_cls + ac->cls[p[i]]];
+		for (w = ac->out[u]; w >= 0; w = ac->out[ac->fail[w]]) {
+			st = i - ac->len[w] + 1;
+			if (beg < 0 || st < beg || (st == beg && ac->len[w] > *len))
+				beg = st, *len = ac->len[w];
+			if (tp) { /* for a given start, longer keywords end later */
+				memcpy(k, s + st, ac->len[w]);
+				k[ac->len[w]] = 0;
+				sprintf(idx, "%d", st + 1);
+				setsval(setsymtab(idx, "", 0.0, STR, tp), k);
+			}
+		}
+	}
+	free(k);
+	return beg + 1;
+}
+
+/************************
+ * sorted() output sink *
+ ************************/
+
+/* print > sorted(file, keys[, mem]) collects the lines printed to file in
+ * runs of up to about mem/(nthr+1)/2 bytes, nthr being the number of CPUs
+ * up to SRT_NTHR. A full run is handed to a thread that parses its keys,
+ * sorts it and writes it, gzip'ed, to a temp file; the last run is sorted
+ * in memory, in nthr pieces at once. At close(), all are merged into file. */
+
+#include <pthread.h>
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define SRT_FUNOPEN /* the BSDs have funopen(), not fopencookie() */
+#endif
+
+#define SRT_NKEY 8
+#define SRT_NTHR 4
+
+typedef struct {
+	int nkey, sep;
+	struct { int col, num, rev; } key[SRT_NKEY];
+} srtspec_t;
+
+typedef struct { /* a key: a number, or a string's first 8 bytes, big end first */
+	union { double d; unsigned long long p; } x;
+	int o, l; /* the string in the line */
+} srtkv_t;
+
+typedef struct {
+	char *s; /* the line, NULL terminated */
+	int l;
+	srtkv_t k[1]; /* nkey of these */
+} srtrec_t;
+
+typedef struct {
+	const srtspec_t *sp;
+	char *buf; size_t l; /* lines, each ending with \n */
+	size_t n;
+	char *rec; /* n srtrec_t, sp->nkey keys each */
+	srtrec_t **a; /* sorted */
+	int keep, fd, err; /* keep: leave it in memory; else fd: the run on disk */
+} srtjob_t;
+
+typedef struct srtsink_s {
+	char *fn;
+	int append, open;
+	srtspec_t sp;
+	int nthr;
+	size_t max; /* bytes of lines in a run */
+	kstring_t buf;
+	srtjob_t *job[SRT_NTHR]; /* being sorted */
+	pthread_t tid[SRT_NTHR];
+	int ijob;
+	int nrun, *run, *lev; /* on disk; lev: merges each run went through */
+	int fanin; /* most runs open at once */
+	struct srtsink_s *next;
+} srtsink_t;
+
+static srtsink_t *srt_sinks;
+
+#define srt_stride(sp) (sizeof(srtrec_t) + ((sp)->nkey > 0? (sp)->nkey - 1 : 0) * sizeof(srtkv_t))
+
+static void srt_parse(const srtspec_t *sp, srtrec_t *r)
+{
+	int i, j, o, l;
+	for (i = 0; i < sp->nkey; ++i) {
+		srtkv_t *k = &r->k[i];
+		char *q;
+		for (j = 1, o = 0; j < sp->key[i].col && o < r->l; ++o) /* start of column col */
+			if (r->s[o] == sp->sep) ++j;
+		if (j < sp->key[i].col) o = r->l; /* no such column: empty */
+		q = memchr(r->s + o, sp->sep, r->l - o);
+		k->o = o, k->l = l = (q? q - r->s : r->l) - o;
+		if (sp->key[i].num) {
+			unsigned char *p = (unsigned char*)r->s + o;
+			double d = 0.0;
+			for (j = 0; j < l && j < 15 && p[j] >= '0' && p[j] <= '9'; ++j) d = d * 10.0 + (p[j] - '0');
+			k->x.d = j == l? d : strtod(r->s + o, 0); /* plain digits are the common case */
+		} else {
+			for (j = 0, k->x.p = 0; j < 8; ++j)
+				k->x.p = k->x.p << 8 | (j < l? (unsigned char)r->s[o + j] : 0);
+		}
+	}
+}
+
+static int srt_cmp(const srtspec_t *sp, const srtrec_t *a, const srtrec_t *b)
+{
+	int i, c, l;
+	for (i = 0; i < sp->nkey; ++i) {
+		const srtkv_t *ka = &a->k[i], *kb = &b->k[i];
+		if (sp->key[i].num) c = (ka->x.d > kb->x.d) - (ka->x.d < kb->x.d);
+		else if (ka->x.p != kb->x.p) c = ka->x.p < kb->x.p? -1 : 1;
+		else {
+			l = ka->l < kb->l? ka->l : kb->l;
+			c = l > 8? memcmp(a->s + ka->o + 8, b->s + kb->o + 8, l - 8) : 0;
+			if (c == 0) c = (ka->l > kb->l) - (ka->l < kb->l);
+		}
+		if (c) return sp->key[i].rev? -c : c;
+	}
+	l = a->l < b->l? a->l : b->l; /* the whole line breaks ties */
+	if ((c = memcmp(a->s, b->s, l)) == 0) c = (a->l > b->l) - (a->l < b->l);
+	return c;
+}
+
+static void srt_msort(const srtspec_t *sp, srtrec_t **a, srtrec_t **t, size_t n) /* stable */
+{
+	size_t i, j, k, m = n / 2;
+	if (n < 2) return;
+	if (n <= 8) { /* insertion sort */
+		for (i = 1; i < n; ++i) {
+			srtrec_t *r = a[i];
+			for (j = i; j > 0 && srt_cmp(sp, a[j-1], r) > 0; --j) a[j] = a[j-1];
+			a[j] = r;
+		}
+		return;
+	}
+	srt_msort(sp, a, t, m);
+	srt_msort(sp, a + m, t, n - m);
+	if (srt_cmp(sp, a[m-1], a[m]) <= 0) return;
+	for (i = k = 0, j = m; i < m && j < n;)
+		t[k++] = srt_cmp(sp, a[j], a[i]) < 0? a[j++] : a[i++];
+	while (i < m) t[k++] = a[i++];
+	memcpy(a, t, k * sizeof(srtrec_t*));
+}
+
+static int srt_tmp(gzFile *fp) /* an unlinked temp file for a run; its fd, or -1 */
+{
+	char tmpl[1024];
+	const char *d = getenv("TMPDIR");
+	int fd;
+	snprintf(tmpl, sizeof(tmpl), "%s/bioawkXXXXXX", d && *d? d : "/tmp");
+	if ((fd = mkstemp(tmpl)) < 0) return -1;
+	unlink(tmpl);
+	if ((*fp = gzdopen(dup(fd), "wb1")) == 0) { close(fd); return -1; }
+	gzbuffer(*fp, 1<<17);
+	return fd;
+}
+
+static void *srt_worker(void *data) /* sort a run; write it out unless keep */
+{
+	srtjob_t *j = (srtjob_t*)data;
+	size_t i, st = srt_stride(j->sp);
+	srtrec_t **t;
+	char *p, *q, *end = j->buf + j->l;
+	for (p = j->buf, j->n = 0; p < end; p = q + 1, ++j->n)
+		q = memchr(p, '\n', end - p);
+	j->rec = (char*)malloc(j->n * st + 1);
+	j->a = (srtrec_t**)malloc(j->n * sizeof(srtrec_t*) + 1);
+	t = (srtrec_t**)malloc(j->n * sizeof(srtrec_t*) + 1);
+	if (j->rec == 0 || j->a == 0 || t == 0) { j->err = 1; free(t); return 0; }
+	for (p = j->buf, i = 0; p < end; p = q + 1, ++i) {
+		srtrec_t *r = (srtrec_t*)(j->rec + i * st);
+		q = memchr(p, '\n', end - p);
+		*q = 0;
+		r->s = p, r->l = q - p;
+		srt_parse(j->sp, r);
+		j->a[i] = r;
+	}
+	srt_msort(j->sp, j->a, t, j->n);
+	free(t);
+	if (!j->keep) {
+		gzFile fp;
+		if ((j->fd = srt_tmp(&fp)) < 0) { j->err = 1; return 0; }
+		for (i = 0; i < j->n; ++i) {
+			j->a[i]->s[j->a[i]->l] = '\n';
+			if (gzwrite(fp, j->a[i]->s, j->a[i]->l + 1) <= 0) j->err = 1;
+		}
+		if (gzclose(fp) != Z_OK) j->err = 1;
+		free(j->buf); free(j->rec); free(j->a);
+		j->buf = j->rec = 0, j->a = 0;
+	}
+	return 0;
+}
+
+static void srt_reduce(srtsink_t *ss);
+
+static srtjob_t *srt_job(srtsink_t *ss, char *buf, size_t l, int keep)
+{
+	srtjob_t *j = (srtjob_t*)calloc(1, sizeof(srtjob_t));
+	if (j == 0) FATAL("out of space in sorted()");
+	j->sp = &ss->sp, j->buf = buf, j->l = l, j->keep = keep, j->fd = -1;
+	return j;
+}
+
+static void srt_join(srtsink_t *ss, int i) /* wait for job i; add its run */
+{
+	srtjob_t *j = ss->job[i];
+	if (j == 0) return;
+	pthread_join(ss->tid[i], 0);
+	ss->job[i] = 0;
+	if (j->err) FATAL("can't write a temporary file for sorted(%s); is TMPDIR writable?", ss->fn);
+	if (j->fd >= 0) {
+		ss->run = (int*)realloc(ss->run, (ss->nrun + 1) * sizeof(int));
+		ss->lev = (int*)realloc(ss->lev, (ss->nrun + 1) * sizeof(int));
+		if (ss->run == 0 || ss->lev == 0) FATAL("out of space in sorted()");
+		ss->lev[ss->nrun] = 0;
+		ss->run[ss->nrun++] = j->fd;
+		srt_reduce(ss);
+	}
+	free(j);
+}
+
+static void srt_spill(srtsink_t *ss) /* hand the complete lines in buf to a thread */
+{
+	char *p, *buf;
+	size_t l;
+	for (p = ss->buf.s + ss->buf.l; p > ss->buf.s && p[-1] != '\n'; --p); /* after the last \n */
+	if (p == ss->buf.s) return;
+	l = p - ss->buf.s;
+	buf = ss->buf.s;
+	ss->buf.m = ss->max + (ss->buf.l - l) + 1; kroundup32(ss->buf.m);
+	if ((ss->buf.s = (char*)malloc(ss->buf.m)) == 0) FATAL("out of space in sorted()");
+	memcpy(ss->buf.s, buf + l, ss->buf.l - l); /* the partial line left over */
+	ss->buf.l -= l;
+	srt_join(ss, ss->ijob);
+	ss->job[ss->ijob] = srt_job(ss, buf, l, 0);
+	if (pthread_create(&ss->tid[ss->ijob], 0, srt_worker, ss->job[ss->ijob]) != 0)
+		FATAL("can't start a thread for sorted()");
+	ss->ijob = (ss->ijob + 1) % ss->nthr;
+}
+
+static ssize_t srt_write(void *c, const char *buf, size_t size)
+{
+	srtsink_t *ss = (srtsink_t*)c;
+	if (ss->buf.l + size + 1 > ss->buf.m) {
+		ss->buf.m = ss->buf.l + size + 1; kroundup32(ss->buf.m);
+		if ((ss->buf.s = (char*)realloc(ss->buf.s, ss->buf.m)) == 0) FATAL("out of space in sorted()");
+	}
+	memcpy(ss->buf.s + ss->buf.l, buf, size);
+	ss->buf.l += size;
+	if (ss->buf.l >= ss->max) srt_spill(ss);
+	return size;
+}
+
+typedef struct { /* an input to the merge */
+	srtrec_t **a; size_t i, n; /* a run in memory */
+	gzFile fp; char *buf; int beg, end; kstring_t str; /* or on disk */
+	srtrec_t *r; /* its next line */
+} srtin_t;
+
+#define SRT_BUF 65536
+
+static int srt_getline(srtin_t *in) /* next line of a run on disk into in->str; 0 at the end */
+{
+	char *q;
+	int l;
+	in->str.l = 0;
+	for (;;) {
+		if (in->beg >= in->end) {
+			in->beg = 0;
+			if ((in->end = gzread(in->fp, in->buf, SRT_BUF)) <= 0) return 0;
+		}
+		q = (char*)memchr(in->buf + in->beg, '\n', in->end - in->beg);
+		l = (q? q - in->buf : in->end) - in->beg;
+		if (in->str.l + l + 1 > in->str.m) {
+			in->str.m = in->str.l + l + 1; kroundup32(in->str.m);
+			if ((in->str.s = (char*)realloc(in->str.s, in->str.m)) == 0) FATAL("out of space in sorted()");
+		}
+		memcpy(in->str.s + in->str.l, in->buf + in->beg, l);
+		in->str.l += l, in->beg += l;
+		if (q) {
+			++in->beg;
+			in->str.s[in->str.l] = 0;
+			return 1;
+		}
+	}
+}
+
+static int srt_next(const srtspec_t *sp, srtin_t *in)
+{
+	if (in->fp == 0) {
+		if (in->i == in->n) return 0;
+		in->r = in->a[in->i++];
+		return 1;
+	}
+	if (!srt_getline(in)) return 0;
+	in->r->s = in->str.s, in->r->l = in->str.l;
+	srt_parse(sp, in->r);
+	return 1;
+}
+
+static void srt_down(const srtspec_t *sp, srtin_t **h, int n, int i) /* heap, least first */
+{
+	srtin_t *t = h[i];
+	int k;
+	while ((k = 2 * i + 1) < n) {
+		if (k + 1 < n && srt_cmp(sp, h[k+1]->r, h[k]->r) < 0) ++k;
+		if (srt_cmp(sp, h[k]->r, t->r) >= 0) break;
+		h[i] = h[k], i = k;
+	}
+	h[i] = t;
+}
+
+static void srt_open(srtsink_t *ss, srtin_t *in, int fd) /* read run fd from the start */
+{
+	lseek(fd, 0, SEEK_SET);
+	if ((in->fp = gzdopen(fd, "rb")) == 0) FATAL("can't read a run of sorted(%s)", ss->fn);
+	in->buf = (char*)malloc(SRT_BUF);
+	if ((in->r = (srtrec_t*)malloc(srt_stride(&ss->sp))) == 0 || in->buf == 0) FATAL("out of space in sorted()");
+}
+
+static int srt_merge(srtsink_t *ss, srtin_t *in, int n, FILE *out, gzFile gz) /* in[0..n) into out, or gz */
+{
+	srtin_t **h;
+	int i, l, err = 0;
+	if ((h = (srtin_t**)calloc(n + 1, sizeof(srtin_t*))) == 0) FATAL("out of space in sorted()");
+	for (i = 0, l = 0; i < n; ++i)
+		if (srt_next(&ss->sp, &in[i])) h[l++] = &in[i];
+	for (i = l / 2 - 1; i >= 0; --i) srt_down(&ss->sp, h, l, i);
+	while (l > 0) { /* k-way merge */
+		srtrec_t *r = h[0]->r;
+		if (gz) {
+			r->s[r->l] = '\n';
+			if (gzwrite(gz, r->s, r->l + 1) <= 0) err = 1;
+			r->s[r->l] = 0;
+		} else {
+			fwrite(r->s, 1, r->l, out);
+			putc('\n', out);
+		}
+		if (!srt_next(&ss->sp, h[0])) h[0] = h[--l];
+		if (l > 0) srt_down(&ss->sp, h, l, 0);
+	}
+	free(h);
+	for (i = 0; i < n; ++i)
+		if (in[i].fp) {
+			gzclose(in[i].fp);
+			free(in[i].buf); free(in[i].str.s); free(in[i].r);
+		}
+	return err;
+}
+
+static void srt_reduce(srtsink_t *ss) /* merge runs on disk so that fewer than fanin stay open */
+{
+	int i, k, n, fd, err;
+	srtin_t *in;
+	gzFile gz;
+	for (;;) {
+		for (n = 1; n < ss->nrun && ss->lev[ss->nrun - 1 - n] == ss->lev[ss->nrun - 1]; ++n);
+		if (n < ss->fanin / 4 && ss->nrun < ss->fanin) break; /* too few alike; or all of them, if too many */
+		if (n < ss->fanin / 4) n = ss->fanin / 4;
+		if (n < 2) n = 2;
+		k = ss->nrun - n;
+		if ((in = (srtin_t*)calloc(n, sizeof(srtin_t))) == 0) FATAL("out of space in sorted()");
+		for (i = 0; i < n; ++i) srt_open(ss, &in[i], ss->run[k + i]);
+		if ((fd = srt_tmp(&gz)) < 0) FATAL("can't write a temporary file for sorted(%s); is TMPDIR writable?", ss->fn);
+		err = srt_merge(ss, in, n, 0, gz);
+		if (gzclose(gz) != Z_OK || err) FATAL("can't write a temporary file for sorted(%s); is TMPDIR writable?", ss->fn);
+		free(in);
+		ss->lev[k] = ss->lev[ss->nrun - 1] + 1; /* the merged run replaces them */
+		ss->run[k] = fd;
+		ss->nrun = k + 1;
+	}
+}
+
+static int srt_close(void *c) /* sort what's left and merge everything into the file */
+{
+	srtsink_t *ss = (srtsink_t*)c, **pp;
+	srtjob_t *mem[SRT_NTHR];
+	srtin_t *in;
+	FILE *out;
+	size_t l, s;
+	int i, n, nmem = 0, ret = 0;
+	char *p, *q, *end;
+
+	for (i = 0; i < SRT_NTHR; ++i) srt_join(ss, i);
+	if (ss->buf.l > 0 && ss->buf.s[ss->buf.l - 1] != '\n') srt_write(ss, "\n", 1);
+	for (p = ss->buf.s, end = p + ss->buf.l; p < end; p = q) { /* nthr pieces, at line ends */
+		l = (ss->buf.l + ss->nthr - 1) / ss->nthr;
+		q = p + l < end? (char*)memchr(p + l - 1, '\n', end - (p + l - 1)) + 1 : end;
+		if ((s = q - p) == 0) break;
+		if ((mem[nmem] = srt_job(ss, (char*)malloc(s), s, 1))->buf == 0) FATAL("out of space in sorted()");
+		memcpy(mem[nmem]->buf, p, s);
+		if (pthread_create(&ss->tid[nmem], 0, srt_worker, mem[nmem]) != 0)
+			FATAL("can't start a thread for sorted()");
+		++nmem;
+	}
+	free(ss->buf.s); ss->buf.s = 0; ss->buf.l = ss->buf.m = 0;
+	for (i = 0; i < nmem; ++i) {
+		pthread_join(ss->tid[i], 0);
+		if (mem[i]->err) FATAL("out of space in sorted()");
+	}
+	n = ss->nrun + nmem; /* nrun < fanin: see srt_reduce() */
+	if ((in = (srtin_t*)calloc(n + 1, sizeof(srtin_t))) == 0) FATAL("out of space in sorted()");
+	for (i = 0; i < ss->nrun; ++i) srt_open(ss, &in[i], ss->run[i]);
+	for (i = 0; i < nmem; ++i)
+		in[ss->nrun + i].a = mem[i]->a, in[ss->nrun + i].n = mem[i]->n;
+	if ((out = fopen(ss->fn, ss->append? "a" : "w")) == 0) FATAL("can't open file %s", ss->fn);
+	srt_merge(ss, in, n, out, 0);
+	if (fclose(out) != 0) ret = -1;
+	for (i = 0; i < nmem; ++i) {
+		free(mem[i]->buf); free(mem[i]->rec); free(mem[i]->a); free(mem[i]);
+	}
+	free(in); free(ss->run); free(ss->lev);
+	for (pp = &srt_sinks; *pp != ss; pp = &(*pp)->next);
+	*pp = ss->next;
+	free(ss->fn); free(ss);
+	return ret;
+}
+
+static void srt_spec(srtspec_t *sp, const char *s) /* "1,2n,5r": columns; n numeric, r reversed */
+{
+	char *p;
+	sp->nkey = 0;
+	sp->sep = strlen(*OFS) == 1? **OFS : '\t';
+	while (*s) {
+		if (sp->nkey == SRT_NKEY) FATAL("sorted: more than %d keys in %s", SRT_NKEY, s);
+		sp->key[sp->nkey].col = strtol(s, &p, 10);
+		if (p == s || sp->key[sp->nkey].col <= 0) FATAL("sorted: bad key %s", s);
+		sp->key[sp->nkey].num = sp->key[sp->nkey].rev = 0;
+		for (; *p && *p != ','; ++p) {
+			if (*p == 'n') sp->key[sp->nkey].num = 1;
+			else if (*p == 'r') sp->key[sp->nkey].rev = 1;
+			else FATAL("sorted: bad key %s", s);
+		}
+		++sp->nkey;
+		s = *p? p + 1 : p;
+	}
+}
+
+static int srt_writable(const char *fn) /* could fn be written? without creating or touching it */
+{
+	char *d, *p;
+	int ok;
+	if (access(fn, F_OK) == 0) return access(fn, W_OK) == 0;
+	d = tostring(fn);
+	if ((p = strrchr(d, '/')) == 0) strcpy(d, ".");
+	else if (p == d) p[1] = 0; /* in / */
+	else *p = 0;
+	ok = access(d, W_OK|X_OK) == 0;
+	free(d);
+	return ok;
+}
+
+static void bio_sorted(const char *fn, const char *keys, const char *mem)
+{
+	srtsink_t *ss;
+	double m = 512.0 * (1<<20);
+	char *p;
+	struct rlimit rl;
+	for (ss = srt_sinks; ss; ss = ss->next)
+		if (strcmp(ss->fn, fn) == 0) return;
+	if (!srt_writable(fn)) /* find out now, not after sorting everything */
+		FATAL("can't open file %s", fn);
+	if (mem) {
+		m = strtod(mem, &p);
+		if (*p == 'k' || *p == 'K') m *= 1<<10;
+		else if (*p == 'm' || *p == 'M') m *= 1<<20;
+		else if (*p == 'g' || *p == 'G') m *= 1<<30;
+		if (m <= 0 || p == mem) FATAL("sorted: bad size %s", mem);
+	}
+	if ((ss = (srtsink_t*)calloc(1, sizeof(srtsink_t))) == 0) FATAL("out of space in sorted()");
+	ss->fn = tostring(fn);
+	srt_spec(&ss->sp, keys);
+	ss->nthr = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ss->nthr < 1) ss->nthr = 1;
+	if (ss->nthr > SRT_NTHR) ss->nthr = SRT_NTHR;
+	ss->max = (size_t)(m / (ss->nthr + 1) / 2);
+	if (ss->max < 1<<16) ss->max = 1<<16;
+	ss->fanin = 64;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur / 2 < 64)
+		ss->fanin = rl.rlim_cur / 2 > 8? rl.rlim_cur / 2 : 8;
+	ss->next = srt_sinks, srt_sinks = ss;
+}
+
+#ifdef SRT_FUNOPEN
+static int srt_fwrite(void *c, const char *buf, int size) { return (int)srt_write(c, buf, size); }
+#endif
+
+FILE *bio_sortopen(const char *fn, int append) /* the sink for fn, if sorted() named it */
+{
+#ifndef SRT_FUNOPEN
+	static cookie_io_functions_t io = { 0, srt_write, 0, srt_close };
+#endif
+	srtsink_t *ss;
+	FILE *fp;
+	for (ss = srt_sinks; ss; ss = ss->next)
+		if (strcmp(ss->fn, fn) == 0 && !ss->open) break;
+	if (ss == 0) return 0;
+#ifdef SRT_FUNOPEN
+	if ((fp = funopen(ss, 0, srt_fwrite, 0, srt_close)) == 0) return 0;
+#else
+	if ((fp = fopencookie(ss, "w", io)) == 0) return 0;
+#endif
+	ss->open = 1, ss->append = append;
+	return fp;
+}
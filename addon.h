@@ -20,6 +20,7 @@ int bio_skip_hdr(const char *r);
 void bio_set_colnm(void);
 
 int bio_getrec(char **pbuf, int *psize, int isrecord);
+FILE *bio_sortopen(const char *fn, int append);
 
 /* The following explains how to add a new function. 1) Add a function index
  * (e.g. #define BIO_FFOO 102) in addon.h. The integer index must be larger than
@@ -42,6 +43,15 @@ int bio_getrec(char **pbuf, int *psize, int isrecord);
 #define BIO_FQUALCOUNT 205
 #define BIO_FTRIMQ    206
 
+#define BIO_FDUMP     301
+#define BIO_FATTACH   302
+#define BIO_FLOADTAB  303
+#define BIO_FLRU      304
+#define BIO_FASORT    305
+#define BIO_FASORTI   306
+#define BIO_FSORTED   307
+#define BIO_FKWMATCH  308
+
 
 struct Cell;
 struct Node;
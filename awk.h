@@ -51,11 +51,14 @@ extern int	safe;		/* 0 => unsafe, 1 => safe */
 #define	RECSIZE	(8 * 1024)	/* sets limit on records, fields, etc., etc. */
 extern int	recsize;	/* size of current record, orig RECSIZE */
 
+#define	NUMBUFSZ	100	/* buffer size for a number converted by fmtnum */
+
 extern char	**FS;
 extern char	**RS;
 extern char	**ORS;
 extern char	**OFS;
 extern char	**OFMT;
+extern char	**CONVFMT;
 extern Awkfloat *NR;
 extern Awkfloat *FNR;
 extern Awkfloat *NF;
@@ -69,6 +72,7 @@ extern int	lineno;		/* line number in awk program */
 extern int	errorflag;	/* 1 if error has occurred */
 extern int	donefld;	/* 1 if record broken into fields */
 extern int	donerec;	/* 1 if record is valid (no fld has changed */
+extern unsigned	recgen;	/* bumped whenever $0 or a field is set */
 extern char	inputFS[];	/* FS at time of input, for field splitting */
 
 extern int	dbg;
@@ -85,17 +89,68 @@ typedef struct Cell {
 	char	*sval;		/* string value */
 	Awkfloat fval;		/* value as number */
 	int	 tval;		/* type info: STR|NUM|ARR|FCN|FLD|CON|DONTFREE */
+	uschar	cfmt;		/* CONV: format that made sval; 0 if any */
+	uschar	celem;		/* array element: the Cell stops here */
 	struct Cell *cnext;	/* ptr to next if chained */
+	char	nbuf[16];	/* short strings live here */
 } Cell;
 
 typedef struct Array {		/* symbol table array */
 	int	nelem;		/* elements in table right now */
-	int	size;		/* size of tab */
-	Cell	**tab;		/* hash table pointers */
+	int	nused;		/* entries of elem used, deleted or not */
+	int	esize;		/* size of elem */
+	Cell	**elem;		/* elements in order of arrival; NULL if deleted */
+	int	lo;		/* dense: key of elem[0] */
+	struct Slot *slot;	/* open-addressed index into elem; NULL if dense */
+	int	nslot;		/* size of slot, a power of 2 */
+	int	nfill;		/* slots live or deleted */
+	struct Slot *oslot;	/* smaller index being moved into slot */
+	int	onslot;		/* size of oslot */
+	int	omove;		/* oslot below here has been moved */
+	int	iter;		/* for (k in a) loops running over this array */
+	int	iwalk;		/* ...of them walking elem by index; it can't move */
+	struct Cell *last;	/* element found last; tried before hashing */
+	struct Page *page;	/* storage for the elements */
+	int	psize;		/* size of page */
+	char	*pnext;		/* free space left in page */
+	int	pleft;
+	struct Cell *efree[32];	/* freed elements, by size class */
+	struct Spill *spill;	/* elements moved to disk under -M, or NULL */
+	long long nspill;	/* how many */
+	struct Attach *map;	/* read-only dump file behind it, or NULL */
+	long long nmap;		/* elements only in there */
+	int	icur;		/* a for-in loop has done elem below here */
+	long long ocur;		/* and the log below here, or -1 */
+	int	sfrom;		/* elem below here is all holes */
+	int	lrucap;		/* lru(): most elements kept, or 0 */
+	struct Cell *lrufcn;	/* lru(): called with each one evicted, or NULL */
+	struct Cell **evict;	/* evicted, waiting for lrufcn or to be freed, */
+	int	evfirst;	/* from here... */
+	int	nevict;		/* ...this many */
+	int	evsize;		/* size of evict */
+	struct Array *enext;	/* arrays with evictions waiting */
+	struct Array *anext;	/* all arrays, if -M */
+	struct Array *aprev;
+	unsigned long long gen;	/* new whenever a key comes or goes */
 } Array;
 
+typedef struct Sitem {		/* an element, copied out to be sorted */
+	char	*k;		/* key */
+	char	*s;		/* string value if STR, else maybe NULL */
+	Awkfloat f;		/* number value if NUM */
+	int	tval;		/* NUM|STR */
+} Sitem;
+
+typedef struct Asort {		/* elements of an array in sorted order */
+	Sitem	*item;
+	int	n;
+	int	size;		/* of item */
+	struct Apool *pool;	/* the strings they point into */
+} Asort;
+
 #define	NSYMTAB	50	/* initial size of a symbol table */
 extern Array	*symtab;
+extern long long arraybudget;	/* -M: bytes arrays may take; 0 if no limit */
 
 extern Cell	*nrloc;		/* NR */
 extern Cell	*fnrloc;	/* FNR */
@@ -112,6 +167,7 @@ extern Cell	*rlengthloc;	/* RLENGTH */
 #define	FCN	040	/* this is a function name */
 #define FLD	0100	/* this is a field $1, $2, ... */
 #define	REC	0200	/* this is $0 */
+#define	CONV	0400	/* sval was converted from fval; see cfmt */
 
 
 /* function types */
@@ -206,7 +262,9 @@ extern	int	pairstack[], paircnt;
 
 #define NCHARS	(256+3)		/* 256 handles 8-bit chars; 128 does 7-bit */
 				/* watch out in match(), etc. */
-#define NSTATES	32
+#define NSTATES	32	/* initial states in a dfa; grows on demand */
+#define FAMEM	(4<<20)	/* but a dfa stops growing at about this size */
+#define FACACHE	(64<<20)	/* bytes of dynamic dfa's kept for reuse */
 
 typedef struct rrow {
 	long	ltype;	/* long avoids pointer warnings on 64-bit */
@@ -218,19 +276,68 @@ typedef struct rrow {
 	int	*lfollow;
 } rrow;
 
+enum { LNONE, LMUST, LEXACT, LBOL };	/* fa.litkind: see b.c */
+
 typedef struct fa {
-	uschar	gototab[NSTATES][NCHARS];
-	uschar	out[NSTATES];
+	int	*gototab;	/* nstates rows of ncls; 0 = not computed yet */
+	int	ncls;		/* classes of chars the re can't tell apart */
+	unsigned short cmap[NCHARS+3];	/* class of each char, and of HAT */
+	uschar	*out;
 	uschar	*restr;
-	int	*posns[NSTATES];
+	int	**posns;
+	int	nstates;	/* rows allocated */
+	int	*hashtab;	/* states by hash of their posns; 0 = empty */
+	int	nhash;		/* size of hashtab, a power of 2 */
 	int	anchor;
 	int	use;
 	int	initstat;
 	int	curstat;
 	int	accept;
 	int	reset;
+	struct	fa *fnext;	/* chain in the cache of dynamic fa's */
+	struct	Bitnfa *bits;	/* bit-parallel form if <= 64 positions */
+	int	usebits;	/* run that: the dfa outgrew FAMEM */
+	uschar	*lit;		/* literal every match contains; see b.c */
+	int	litkind;
+	int	nlit;
+	int	nrule;		/* > 0: a multi-accept dfa; see mkmulti */
+	unsigned *seen;		/* multimatch call that last reported each state */
+	unsigned gen;
 	struct	rrow re[1];	/* variable: actual size set by calling malloc */
 } fa;
 
+/* code for the stack machine in vm.c, and for what --emit-c makes of it */
+
+typedef struct Inst {
+	int	op;
+	int	n;
+	union {
+		Awkfloat f;
+		Cell	*c;
+		Node	*p;
+		struct Cell *(*fn)(struct Inst *);
+	} u;
+} Inst;
+
+typedef struct Vslot {	/* a value on the stack: a number if c is NULL */
+	Awkfloat f;
+	Cell	*c;
+} Vslot;
+
+typedef struct Ncode {	/* code for one list, compiled to C by --emit-c */
+	Cell	*(*fn)(Inst *);
+	int	n;	/* instructions it was made from, as a check */
+} Ncode;
+
+extern	char	*aotprog;	/* the program and its code, if compiled in */
+extern	Ncode	*aotcode;
+
+extern	Cell	*convfmtloc, *ofmtloc;
+
+/* getfval and setfval, done here for a variable that is just a number */
+#define	GETF(x)	(((x)->tval & (NUM|FLD|REC)) == NUM ? (x)->fval : getfval(x))
+#define	SETF(x, v)	(((x)->tval & (NUM|STR|CONV|FLD|REC)) == NUM \
+	&& (x) != convfmtloc && (x) != ofmtloc ? ((x)->fval = (v)) : setfval(x, v))
+
 
 #include "proto.h"
@@ -46,7 +46,7 @@ Node	*arglist = 0;	/* list of args for current function */
 }
 
 %token	<i>	FIRSTTOKEN	/* must be first */
-%token	<p>	PROGRAM PASTAT PASTAT2 XBEGIN XEND
+%token	<p>	PROGRAM PASTAT PASTAT2 XBEGIN XEND CODE
 %token	<i>	NL ',' '{' '(' '|' ';' '/' ')' '}' '[' ']'
 %token	<i>	ARRAY
 %token	<i>	MATCH NOTMATCH MATCHOP
@@ -467,7 +467,7 @@ Node *notnull(Node *n)
 {
 	switch (n->nobj) {
 	case LE: case LT: case EQ: case NE: case GT: case GE:
-	case BOR: case AND: case NOT:
+	case BOR: case AND: case NOT: case MATCH: case NOTMATCH:
 		return n;
 	default:
 		return op2(NE, n, nullnode);
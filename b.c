@@ -27,6 +27,7 @@ THIS SOFTWARE.
 #define	DEBUG
 
 #include <ctype.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -36,6 +37,8 @@ THIS SOFTWARE.
 #define	HAT	(NCHARS+2)	/* matches ^ in regular expr */
 				/* NCHARS is 2**n */
 #define MAXLIN 22
+#define	ROW(f, s)	(&(f)->gototab[(s) * (f)->ncls])
+#define	GOTO(f, s, c)	ROW(f, s)[(f)->cmap[c]]
 
 #define type(v)		(v)->nobj	/* badly overloaded here */
 #define info(v)		(v)->ntype	/* badly overloaded here */
@@ -72,14 +75,69 @@ static	int poscnt;
 char	*patbeg;
 int	patlen;
 
-#define	NFA	20	/* cache this many dynamic fa's */
-fa	*fatab[NFA];
-int	nfatab	= 0;	/* entries in fatab */
+/*
+ * dynamic regular expressions are cached by the text of the re in a
+ * hash table that doubles as it fills.  the cache is bounded by the
+ * memory its dfa's hold, FACACHE bytes, not by a count of them; when
+ * it is over, the least recently used go first.  a dfa keeps the
+ * states it has built, so each re is compiled once per run unless
+ * the working set really doesn't fit.
+ */
+
+static	fa	**fatab;	/* hash of dynamic fa's, chained on fnext */
+static	int	nfatab	= 0;	/* entries in fatab */
+static	int	fasize	= 0;	/* size of fatab, a power of 2 */
+
+static void mkclasses(fa *);
+static void mkbits(fa *, int);
+static int leafmatch(fa *, int, int);
+static int bmatch(fa *, const char *);
+static int bpmatch(fa *, const char *);
+static int bnematch(fa *, const char *);
+static void growfa(fa *, int);
+static void rehash(fa *);
+static void reinit(fa *);
+
+static size_t fabytes(fa *f)	/* approximate memory held by f */
+{
+	return sizeof(fa) + f->accept * sizeof(rrow)
+		+ f->nstates * (f->ncls * sizeof(int) + 1 + sizeof(int *))
+		+ f->nhash * sizeof(int);
+}
+
+static int faslot(const char *s, int anchor)
+{
+	return (hash(s) + anchor) & (fasize - 1);
+}
+
+static void faevict(fa *keep)	/* trim the cache down to FACACHE */
+{
+	int i;
+	size_t tot;
+	fa *f, **pp, **lru;
+
+	for (;;) {
+		tot = 0;
+		lru = NULL;
+		for (i = 0; i < fasize; i++)
+			for (pp = &fatab[i]; (f = *pp) != NULL; pp = &f->fnext) {
+				tot += fabytes(f);
+				if (f != keep && (lru == NULL || f->use < (*lru)->use))
+					lru = pp;
+			}
+		if (tot <= FACACHE || lru == NULL)
+			return;
+		f = *lru;
+		*lru = f->fnext;
+		nfatab--;
+		freefa(f);
+	}
+}
 
 fa *makedfa(const char *s, int anchor)	/* returns dfa for reg expr s */
 {
-	int i, use, nuse;
-	fa *pfa;
+	int i, h;
+	fa *pfa, *next, **nt;
 	static int now = 1;
 
 	if (setvec == 0) {	/* first time through any RE */
@@ -92,39 +150,132 @@ fa *makedfa(const char *s, int anchor)	/* returns dfa for reg expr s */
 
 	if (compile_time)	/* a constant for sure */
 		return mkdfa(s, anchor);
-	for (i = 0; i < nfatab; i++)	/* is it there already? */
-		if (fatab[i]->anchor == anchor
-		  && strcmp((const char *) fatab[i]->restr, s) == 0) {
-			fatab[i]->use = now++;
-			return fatab[i];
+	if (fatab == NULL) {
+		fasize = 64;
+		if ((fatab = (fa **) calloc(fasize, sizeof(fa *))) == NULL)
+			overflo("out of space for fa cache");
+	}
+	for (pfa = fatab[faslot(s, anchor)]; pfa != NULL; pfa = pfa->fnext)
+		if (pfa->anchor == anchor
+		  && strcmp((const char *) pfa->restr, s) == 0) {	/* is it there already? */
+			pfa->use = now++;
+			return pfa;
 		}
 	pfa = mkdfa(s, anchor);
-	if (nfatab < NFA) {	/* room for another */
-		fatab[nfatab] = pfa;
-		fatab[nfatab]->use = now++;
-		nfatab++;
-		return pfa;
-	}
-	use = fatab[0]->use;	/* replace least-recently used */
-	nuse = 0;
-	for (i = 1; i < nfatab; i++)
-		if (fatab[i]->use < use) {
-			use = fatab[i]->use;
-			nuse = i;
-		}
-	freefa(fatab[nuse]);
-	fatab[nuse] = pfa;
 	pfa->use = now++;
+	if (nfatab >= fasize) {	/* grow the table */
+		if ((nt = (fa **) calloc(2 * fasize, sizeof(fa *))) == NULL)
+			overflo("out of space for fa cache");
+		for (i = 0; i < fasize; i++)
+			for (; fatab[i] != NULL; fatab[i] = next) {
+				next = fatab[i]->fnext;
+				h = (hash((const char *) fatab[i]->restr) + fatab[i]->anchor) & (2 * fasize - 1);
+				fatab[i]->fnext = nt[h];
+				nt[h] = fatab[i];
+			}
+		free(fatab);
+		fatab = nt;
+		fasize *= 2;
+	}
+	h = faslot(s, anchor);
+	pfa->fnext = fatab[h];
+	fatab[h] = pfa;
+	nfatab++;
+	faevict(pfa);
 	return pfa;
 }
 
+/*
+ * before a dfa is built, the parse tree is searched for a literal
+ * that every match must contain.  if there is one, strstr (which
+ * the c library does a word or a vector at a time) can reject a
+ * string before the dfa looks at a byte of it.  an re that is
+ * nothing but a literal, or ^ and a literal, never runs the dfa.
+ */
+
+#define	MAXLIT	32
+
+typedef struct Lit {
+	int	exact;	/* matches just pre */
+	int	bol;	/* matches ^ then just pre */
+	int	npre, nsuf, nmust;
+	uschar	pre[MAXLIT];	/* every match starts with this */
+	uschar	suf[MAXLIT];	/* ... ends with this */
+	uschar	must[MAXLIT+1];	/* ... contains this */
+} Lit;
+
+static int litcat(uschar *d, int nd, const uschar *s, int ns, int tail)
+{	/* append s to d; if it won't fit, keep the head or the tail */
+	uschar buf[2*MAXLIT];
+
+	memcpy(buf, d, nd);
+	memcpy(buf+nd, s, ns);
+	if ((nd += ns) > MAXLIT) {
+		memcpy(d, tail ? buf+nd-MAXLIT : buf, MAXLIT);
+		return MAXLIT;
+	}
+	memcpy(d, buf, nd);
+	return nd;
+}
+
+static void litscan(Node *p, Lit *l)	/* fill l for the re rooted at p */
+{
+	Lit a, b;
+	int c, n;
+	uschar tmp[MAXLIT];
+
+	memset(l, 0, offsetof(Lit, pre));
+	switch (type(p)) {
+	case CHAR:
+		if ((c = ptoi(right(p))) == HAT) {	/* ^ is empty but anchors */
+			l->bol = 1;
+		} else if (c != 0) {		/* 0 is $ */
+			l->exact = 1;
+			l->pre[0] = l->suf[0] = l->must[0] = c;
+			l->npre = l->nsuf = l->nmust = 1;
+		}
+		break;
+	case PLUS:
+		litscan(left(p), l);
+		l->exact = l->bol = 0;
+		break;
+	case CAT:
+		litscan(left(p), &a);
+		litscan(right(p), &b);
+		l->exact = a.exact && b.exact;
+		l->bol = a.bol && b.exact;
+		memcpy(l->pre, a.pre, l->npre = a.npre);
+		if (a.exact || a.bol)
+			l->npre = litcat(l->pre, l->npre, b.pre, b.npre, 0);
+		memcpy(l->suf, b.suf, l->nsuf = b.nsuf);
+		if (b.exact || b.bol) {
+			memcpy(l->suf, a.suf, l->nsuf = a.nsuf);
+			l->nsuf = litcat(l->suf, l->nsuf, b.suf, b.nsuf, 1);
+		}
+		if (a.npre + b.npre > MAXLIT)	/* too long to be sure of */
+			l->exact = l->bol = 0;
+		memcpy(l->must, a.must, l->nmust = a.nmust);
+		if (b.nmust > l->nmust)
+			memcpy(l->must, b.must, l->nmust = b.nmust);
+		memcpy(tmp, a.suf, n = a.nsuf);
+		n = litcat(tmp, n, b.pre, b.npre, 0);
+		if (n > l->nmust)
+			memcpy(l->must, tmp, l->nmust = n);
+		if (l->exact || l->bol)
+			memcpy(l->must, l->pre, l->nmust = l->npre);
+		break;
+	}	/* anything else might match nothing in particular */
+}
+
 fa *mkdfa(const char *s, int anchor)	/* does the real work of making a dfa */
 				/* anchor = 1 for anchored matches, else 0 */
 {
 	Node *p, *p1;
 	fa *f;
+	Lit l;
 
 	p = reparse(s);
+	litscan(p, &l);
 	p1 = op2(CAT, op2(STAR, op2(ALL, NIL, NIL), NIL), p);
 		/* put ALL STAR in front of reg.  exp. */
 	p1 = op2(CAT, p1, op2(FINAL, NIL, NIL));
@@ -137,6 +288,8 @@ fa *mkdfa(const char *s, int anchor)	/* does the real work of making a dfa */
 	f->accept = poscnt-1;	/* penter has computed number of positions in re */
 	cfoll(f, p1);	/* set up follow sets */
 	freetr(p1);
+	mkclasses(f);
+	growfa(f, NSTATES);
 	if ((f->posns[0] = (int *) calloc(1, *(f->re[0].lfollow)*sizeof(int))) == NULL)
 			overflo("out of space in makedfa");
 	if ((f->posns[1] = (int *) calloc(1, sizeof(int))) == NULL)
@@ -144,10 +297,71 @@ fa *mkdfa(const char *s, int anchor)	/* does the real work of making a dfa */
 	*f->posns[1] = 0;
 	f->initstat = makeinit(f, anchor);
 	f->anchor = anchor;
+	mkbits(f, anchor);
 	f->restr = (uschar *) tostring(s);
+	if (l.exact && l.npre > 0)
+		f->litkind = LEXACT;
+	else if (l.bol && l.npre > 0)
+		f->litkind = LBOL;
+	else if (l.nmust > 1)
+		f->litkind = LMUST;
+	if (f->litkind != LNONE) {
+		l.must[l.nmust] = 0;
+		f->lit = (uschar *) tostring((char *) l.must);
+		f->nlit = l.nmust;
+	}
+	return f;
+}
+
+/*
+ * a program with many /re/ { ... } rules has all their re's run as
+ * one dfa: the union of the re's, each with its own FINAL that
+ * remembers (in its right) which rule it ends.  multimatch goes over
+ * the string once and reports every rule that matched anywhere.
+ */
+
+fa *mkmulti(char **re, int n)	/* one dfa for the rules re[0..n-1] */
+{
+	Node *p, *q;
+	fa *f;
+	int i;
+
+	p = NULL;
+	for (i = 0; i < n; i++) {
+		q = op2(CAT, reparse(re[i]), op2(FINAL, NIL, itonp(i)));
+		p = p == NULL ? q : op2(OR, p, q);
+	}
+	p = op2(CAT, op2(STAR, op2(ALL, NIL, NIL), NIL), p);
+	poscnt = 0;
+	penter(p);
+	if ((f = (fa *) calloc(1, sizeof(fa) + poscnt*sizeof(rrow))) == NULL)
+		overflo("out of space for fa");
+	f->accept = poscnt-1;
+	f->nrule = n;
+	cfoll(f, p);
+	freetr(p);
+	mkclasses(f);
+	growfa(f, NSTATES);
+	if ((f->posns[0] = (int *) calloc(1, *(f->re[0].lfollow)*sizeof(int))) == NULL)
+		overflo("out of space in mkmulti");
+	if ((f->posns[1] = (int *) calloc(1, sizeof(int))) == NULL)
+		overflo("out of space in mkmulti");
+	f->initstat = makeinit(f, 0);
 	return f;
 }
 
+static int isfinal(fa *f, const int *p)	/* does the set of positions p accept? */
+{
+	int i;
+
+	if (f->nrule == 0)
+		return p[0] > 0 && p[1] == f->accept;
+	for (i = 1; i <= p[0]; i++)
+		if (f->re[p[i]].ltype == FINAL)
+			return 1;
+	return 0;
+}
+
 int makeinit(fa *f, int anchor)
 {
 	int i, k;
@@ -162,10 +376,11 @@ int makeinit(fa *f, int anchor)
 	for (i=0; i <= k; i++) {
 		(f->posns[2])[i] = (f->re[0].lfollow)[i];
 	}
-	if ((f->posns[2])[1] == f->accept)
-		f->out[2] = 1;
-	for (i=0; i < NCHARS; i++)
-		f->gototab[2][i] = 0;
+	f->out[2] = isfinal(f, f->posns[2]);
+	if (f->seen != NULL)
+		f->seen[2] = 0;
+	memset(ROW(f, 2), 0, f->ncls * sizeof(int));
+	rehash(f);
 	f->curstat = cgoto(f, 2, HAT);
 	if (anchor) {
 		*f->posns[2] = k-1;	/* leave out position 0 */
@@ -176,6 +391,7 @@ int makeinit(fa *f, int anchor)
 		f->out[0] = f->out[2];
 		if (f->curstat != 2)
 			--(*f->posns[f->curstat]);
+		rehash(f);	/* those sets just changed under the hash */
 	}
 	return f->curstat;
 }
@@ -455,6 +671,48 @@ void follow(Node *v)	/* collects leaves that can follow v into setvec */
 	}
 }
 
+/*
+ * gototab has a column for each class of chars that no leaf of the
+ * re tells apart, not for each char: [ACGT]+N needs 5 or so, not 259,
+ * which keeps many more states in cache.  0 ($) and HAT have classes
+ * of their own.  a leaf splits every class into the chars it matches
+ * and the rest.
+ */
+
+static void mkclasses(fa *f)
+{
+	uschar in[NCHARS], *s;
+	short map[2][HAT+1];
+	int i, c, k, n, t;
+
+	for (c = 1; c < NCHARS; c++)
+		f->cmap[c] = 0;
+	f->cmap[0] = 1;
+	f->cmap[HAT] = 2;
+	n = 3;
+	for (i = 0; i <= f->accept; i++) {
+		t = f->re[i].ltype;
+		memset(in, 0, sizeof(in));
+		if (t == CHAR) {
+			if ((c = ptoi(f->re[i].lval.np)) > 0 && c < NCHARS)
+				in[c] = 1;
+		} else if (t == CCL || t == NCCL) {
+			for (s = f->re[i].lval.up; *s; s++)
+				in[*s] = 1;
+		} else
+			continue;
+		for (k = 0; k < n; k++)
+			map[0][k] = map[1][k] = -1;
+		for (c = 1; c < NCHARS; c++) {
+			k = f->cmap[c];
+			if (map[in[c]][k] < 0)	/* first of k on this side */
+				map[in[c]][k] = map[!in[c]][k] < 0 ? k : n++;
+			f->cmap[c] = map[in[c]][k];
+		}
+	}
+	f->ncls = n;
+}
+
 int member(int c, const char *sarg)	/* is c in s? */
 {
 	uschar *s = (uschar *) sarg;
@@ -465,17 +723,47 @@ int member(int c, const char *sarg)	/* is c in s? */
 	return(0);
 }
 
+static int litmatch(fa *f, const char *p)	/* match by f->lit; -1 if the dfa has to */
+{
+	const char *q;
+
+	patbeg = (char *) p;
+	patlen = -1;
+	switch (f->litkind) {
+	case LEXACT:
+		if ((q = strstr(p, (char *) f->lit)) == NULL)
+			return 0;
+		patbeg = (char *) q;
+		patlen = f->nlit;
+		return 1;
+	case LBOL:	/* initstat 2 is gsub saying ^ is past */
+		if (f->initstat == 2 || strncmp(p, (char *) f->lit, f->nlit) != 0)
+			return 0;
+		patlen = f->nlit;
+		return 1;
+	case LMUST:
+		if (strstr(p, (char *) f->lit) == NULL)
+			return 0;
+		break;
+	}
+	return -1;
+}
+
 int match(fa *f, const char *p0)	/* shortest match ? */
 {
 	int s, ns;
 	uschar *p = (uschar *) p0;
 
+	if (f->litkind != LNONE && (s = litmatch(f, p0)) >= 0)
+		return s;
+	if (f->usebits)
+		return bmatch(f, p0);
 	s = f->reset ? makeinit(f,0) : f->initstat;
 	if (f->out[s])
 		return(1);
 	do {
 		/* assert(*p < NCHARS); */
-		if ((ns = f->gototab[s][*p]) != 0)
+		if ((ns = GOTO(f, s, *p)) != 0)
 			s = ns;
 		else
 			s = cgoto(f, s, *p);
@@ -485,13 +773,50 @@ int match(fa *f, const char *p0)	/* shortest match ? */
 	return(0);
 }
 
+int multimatch(fa *f, const char *p0, uschar *hit)	/* set hit[i] if rule i matches */
+{						/* returns number of new hits */
+	int i, k, n, s, ns, *q;
+	uschar *p = (uschar *) p0;
+
+	if (++f->gen == 0) {	/* wrapped: forget the old marks */
+		memset(f->seen, 0, f->nstates * sizeof(unsigned));
+		f->gen = 1;
+	}
+	n = 0;
+	s = f->reset ? makeinit(f,0) : f->initstat;
+	for (;;) {
+		if (f->out[s] && f->seen[s] != f->gen) {	/* each state once */
+			f->seen[s] = f->gen;
+			q = f->posns[s];
+			for (i = 1; i <= *q; i++)
+				if (f->re[q[i]].ltype == FINAL
+				  && !hit[k = ptoi(f->re[q[i]].lval.np)]) {
+					hit[k] = 1;
+					n++;
+				}
+		}
+		if (p == NULL)
+			break;
+		if ((ns = GOTO(f, s, *p)) != 0)
+			s = ns;
+		else
+			s = cgoto(f, s, *p);
+		if (*p++ == 0)
+			p = NULL;	/* the transition on the 0 is for $ */
+	}
+	return n;
+}
+
 int pmatch(fa *f, const char *p0)	/* longest match, for sub */
 {
 	int s, ns;
 	uschar *p = (uschar *) p0;
 	uschar *q;
-	int i, k;
 
+	if (f->litkind != LNONE && (s = litmatch(f, p0)) >= 0)
+		return s;
+	if (f->usebits)
+		return bpmatch(f, p0);
 	/* s = f->reset ? makeinit(f,1) : f->initstat; */
 	if (f->reset) {
 		f->initstat = s = makeinit(f,1);
@@ -506,7 +831,7 @@ int pmatch(fa *f, const char *p0)	/* longest match, for sub */
 			if (f->out[s])		/* final state */
 				patlen = q-p;
 			/* assert(*q < NCHARS); */
-			if ((ns = f->gototab[s][*q]) != 0)
+			if ((ns = GOTO(f, s, *q)) != 0)
 				s = ns;
 			else
 				s = cgoto(f, s, *q);
@@ -527,19 +852,8 @@ int pmatch(fa *f, const char *p0)	/* longest match, for sub */
 		}
 	nextin:
 		s = 2;
-		if (f->reset) {
-			for (i = 2; i <= f->curstat; i++)
-				xfree(f->posns[i]);
-			k = *f->posns[0];			
-			if ((f->posns[2] = (int *) calloc(1, (k+1)*sizeof(int))) == NULL)
-				overflo("out of space in pmatch");
-			for (i = 0; i <= k; i++)
-				(f->posns[2])[i] = (f->posns[0])[i];
-			f->initstat = f->curstat = 2;
-			f->out[2] = f->out[0];
-			for (i = 0; i < NCHARS; i++)
-				f->gototab[2][i] = 0;
-		}
+		if (f->reset)
+			reinit(f);
 	} while (*p++ != 0);
 	return (0);
 }
@@ -549,8 +863,11 @@ int nematch(fa *f, const char *p0)	/* non-empty match, for sub */
 	int s, ns;
 	uschar *p = (uschar *) p0;
 	uschar *q;
-	int i, k;
 
+	if (f->litkind != LNONE && (s = litmatch(f, p0)) >= 0)
+		return s;
+	if (f->usebits)
+		return bnematch(f, p0);
 	/* s = f->reset ? makeinit(f,1) : f->initstat; */
 	if (f->reset) {
 		f->initstat = s = makeinit(f,1);
@@ -564,7 +881,7 @@ int nematch(fa *f, const char *p0)	/* non-empty match, for sub */
 			if (f->out[s])		/* final state */
 				patlen = q-p;
 			/* assert(*q < NCHARS); */
-			if ((ns = f->gototab[s][*q]) != 0)
+			if ((ns = GOTO(f, s, *q)) != 0)
 				s = ns;
 			else
 				s = cgoto(f, s, *q);
@@ -584,24 +901,207 @@ int nematch(fa *f, const char *p0)	/* non-empty match, for sub */
 		}
 	nnextin:
 		s = 2;
-		if (f->reset) {
-			for (i = 2; i <= f->curstat; i++)
-				xfree(f->posns[i]);
-			k = *f->posns[0];			
-			if ((f->posns[2] = (int *) calloc(1, (k+1)*sizeof(int))) == NULL)
-				overflo("out of state space");
-			for (i = 0; i <= k; i++)
-				(f->posns[2])[i] = (f->posns[0])[i];
-			f->initstat = f->curstat = 2;
-			f->out[2] = f->out[0];
-			for (i = 0; i < NCHARS; i++)
-				f->gototab[2][i] = 0;
+		if (f->reset)
+			reinit(f);
+		p++;
+	}
+	return (0);
+}
+
+/*
+ * an re with at most 64 positions can also be run as a bit-parallel
+ * nfa.  a word holds a set of positions, as posns does for a state of
+ * the dfa, and a char takes it to the next set with the mask of the
+ * positions its class matches and a table lookup for each byte of
+ * those.  nothing is built while matching, so this is what an re
+ * runs on once its dfa outgrows FAMEM, instead of throwing its states
+ * away and building them again and again.
+ */
+
+typedef unsigned long long Bits;
+
+typedef struct Bitnfa {
+	Bits	*cmask;		/* [class]: positions that match it */
+	Bits	(*fol)[256];	/* [k][b]: union of the follow sets of */
+				/* the positions 8k+i for the bits i of b */
+	Bits	first;		/* as state 2 */
+	Bits	start;		/* as initstat: first after ^ */
+	Bits	fin;		/* the FINAL position */
+} Bitnfa;
+
+static void mkbits(fa *f, int anchor)
+{
+	Bitnfa *b;
+	Bits fw[64];
+	int i, j, k, n, rep[HAT+1];
+	int *q;
+
+	if ((n = f->accept + 1) > 64)
+		return;
+	if ((b = (Bitnfa *) calloc(1, sizeof(Bitnfa))) == NULL
+	 || (b->cmask = (Bits *) calloc(f->ncls, sizeof(Bits))) == NULL
+	 || (b->fol = (Bits (*)[256]) calloc((n+7)/8, sizeof(*b->fol))) == NULL)
+		overflo("out of space in mkbits");
+	for (i = 0; i < n; i++) {
+		fw[i] = 0;
+		if ((q = f->re[i].lfollow) != NULL)
+			for (j = 1; j <= *q; j++)
+				fw[i] |= 1ULL << q[j];
+	}
+	for (i = 0; i <= HAT; i++)
+		if (i < NCHARS || i == HAT)
+			rep[f->cmap[i]] = i;
+	for (k = 0; k < f->ncls; k++)
+		for (i = 0; i < n; i++)
+			if (leafmatch(f, i, rep[k]))
+				b->cmask[k] |= 1ULL << i;
+	for (k = 0; k < (n+7)/8; k++)
+		for (j = 1; j < 256; j++) {
+			for (i = 0; !(j >> i & 1); i++)
+				;	/* lowest bit of j */
+			i += 8*k;
+			b->fol[k][j] = b->fol[k][j & (j-1)] | (i < n ? fw[i] : 0);
 		}
+	b->first = fw[0];	/* as makeinit */
+	b->start = 0;
+	for (i = 0; i < n; i++)
+		if ((b->first >> i & 1) && leafmatch(f, i, HAT))
+			b->start |= fw[i];
+	if (anchor) {	/* leave out position 0 */
+		b->first &= ~1ULL;
+		b->start &= ~1ULL;
+	}
+	b->fin = 1ULL << f->accept;
+	f->bits = b;
+}
+
+static Bits bstep(Bitnfa *b, Bits d, int k)	/* positions after class k */
+{
+	Bits r = 0;
+	int i;
+
+	for (d &= b->cmask[k], i = 0; d != 0; d >>= 8, i++)
+		r |= b->fol[i][d & 0xff];
+	return r;
+}
+
+static Bits bstart(fa *f, int anchor)	/* positions to start from */
+{
+	if (f->reset)	/* initstat is stale, as the dfa's first turn would find */
+		f->initstat = makeinit(f, anchor);
+	return f->initstat == 2 ? f->bits->first : f->bits->start;
+}
+
+/* the three below follow match, pmatch and nematch step for step */
+
+static int bmatch(fa *f, const char *p0)
+{
+	Bitnfa *b = f->bits;
+	uschar *p = (uschar *) p0;
+	Bits d;
+
+	d = bstart(f, 0);
+	if (d & b->fin)
+		return(1);
+	do {
+		if ((d = bstep(b, d, f->cmap[*p])) & b->fin)
+			return(1);
+		if (d == 0)
+			return(0);
+	} while (*p++ != 0);
+	return(0);
+}
+
+static int bpmatch(fa *f, const char *p0)
+{
+	Bitnfa *b = f->bits;
+	uschar *p = (uschar *) p0;
+	uschar *q;
+	Bits d, d0;
+
+	d0 = bstart(f, 1);
+	patbeg = (char *) p;
+	patlen = -1;
+	do {
+		q = p;
+		d = d0;
+		do {
+			if (d & b->fin)
+				patlen = q-p;
+			if ((d = bstep(b, d, f->cmap[*q])) == 0) {
+				if (patlen >= 0) {
+					patbeg = (char *) p;
+					return(1);
+				}
+				else
+					goto nextin;
+			}
+		} while (*q++ != 0);
+		if (d & b->fin)
+			patlen = q-p-1;	/* don't count $ */
+		if (patlen >= 0) {
+			patbeg = (char *) p;
+			return(1);
+		}
+	nextin:
+		d0 = b->first;
+	} while (*p++ != 0);
+	return (0);
+}
+
+static int bnematch(fa *f, const char *p0)
+{
+	Bitnfa *b = f->bits;
+	uschar *p = (uschar *) p0;
+	uschar *q;
+	Bits d, d0;
+
+	d0 = bstart(f, 1);
+	patlen = -1;
+	while (*p) {
+		q = p;
+		d = d0;
+		do {
+			if (d & b->fin)
+				patlen = q-p;
+			if ((d = bstep(b, d, f->cmap[*q])) == 0) {
+				if (patlen > 0) {
+					patbeg = (char *) p;
+					return(1);
+				} else
+					goto nnextin;
+			}
+		} while (*q++ != 0);
+		if (d & b->fin)
+			patlen = q-p-1;	/* don't count $ */
+		if (patlen > 0 ) {
+			patbeg = (char *) p;
+			return(1);
+		}
+	nnextin:
+		d0 = b->first;
 		p++;
 	}
 	return (0);
 }
 
+static void reinit(fa *f)	/* back to the initial state after a reset */
+{
+	int i, k;
+
+	for (i = 2; i <= f->curstat; i++)
+		xfree(f->posns[i]);
+	k = *f->posns[0];
+	if ((f->posns[2] = (int *) calloc(1, (k+1)*sizeof(int))) == NULL)
+		overflo("out of state space");
+	for (i = 0; i <= k; i++)
+		(f->posns[2])[i] = (f->posns[0])[i];
+	f->initstat = f->curstat = 2;
+	f->out[2] = f->out[0];
+	memset(ROW(f, 2), 0, f->ncls * sizeof(int));
+	rehash(f);
+}
+
 Node *reparse(const char *p)	/* parses regular expression pointed to by p */
 {			/* uses relex() to scan regular expression */
 	Node *np;
@@ -850,9 +1350,89 @@ int relex(void)		/* lexical analyzer for reparse */
 	}
 }
 
+/*
+ * the states of a dfa are built lazily, one transition at a time,
+ * and kept in a table that doubles when it fills, up to FAMEM bytes
+ * of gototab.  a new position set is looked up in a hash on the
+ * sets rather than compared against every state; only a dfa that
+ * outgrows its budget still throws its states away and starts over.
+ */
+
+static unsigned sethash(const int *p)
+{
+	unsigned h = p[0];
+	int i;
+
+	for (i = 1; i <= p[0]; i++)
+		h = h * 31 + p[i];
+	h *= 2654435761U;
+	return h ^ h >> 16;
+}
+
+static void hashstate(fa *f, int n)	/* enter state n into the hash */
+{
+	int m = f->nhash - 1;
+	unsigned h;
+
+	for (h = sethash(f->posns[n]) & m; f->hashtab[h] != 0; h = (h+1) & m)
+		;
+	f->hashtab[h] = n;
+}
+
+static void rehash(fa *f)	/* rebuild the hash from states 1..curstat */
+{
+	int i;
+
+	memset(f->hashtab, 0, f->nhash * sizeof(int));
+	for (i = 1; i <= f->curstat; i++)
+		if (f->posns[i] != NULL)
+			hashstate(f, i);
+}
+
+static void growfa(fa *f, int n)	/* make room for n states */
+{
+	int i;
+
+	if ((f->gototab = (int *) realloc(f->gototab, n * f->ncls * sizeof(int))) == NULL
+	 || (f->out = (uschar *) realloc(f->out, n)) == NULL
+	 || (f->posns = (int **) realloc(f->posns, n * sizeof(int *))) == NULL)
+		overflo("out of space for dfa states");
+	memset(ROW(f, f->nstates), 0, (n - f->nstates) * f->ncls * sizeof(int));
+	if (f->nrule > 0
+	 && (f->seen = (unsigned *) realloc(f->seen, n * sizeof(unsigned))) == NULL)
+		overflo("out of space for dfa states");
+	for (i = f->nstates; i < n; i++) {
+		f->out[i] = 0;
+		f->posns[i] = NULL;
+		if (f->seen != NULL)
+			f->seen[i] = 0;
+	}
+	f->nstates = n;
+	xfree(f->hashtab);
+	for (f->nhash = 64; f->nhash < 2 * n; f->nhash *= 2)
+		;
+	if ((f->hashtab = (int *) calloc(f->nhash, sizeof(int))) == NULL)
+		overflo("out of space for dfa states");
+	rehash(f);
+}
+
+static int leafmatch(fa *f, int i, int c)	/* does position i match c? */
+{
+	switch (f->re[i].ltype) {
+	case CHAR:	return c == ptoi(f->re[i].lval.np);
+	case DOT:	return c != 0 && c != HAT;
+	case ALL:	return c != 0;
+	case EMPTYRE:	return c != 0;
+	case CCL:	return member(c, (char *) f->re[i].lval.up);
+	case NCCL:	return !member(c, (char *) f->re[i].lval.up) && c != 0 && c != HAT;
+	}
+	return 0;	/* FINAL */
+}
+
 int cgoto(fa *f, int s, int c)
 {
 	int i, j, k;
+	unsigned h;
 	int *p, *q;
 
 	assert(c == HAT || c < NCHARS);
@@ -869,26 +1449,19 @@ int cgoto(fa *f, int s, int c)
 	/* compute positions of gototab[s,c] into setvec */
 	p = f->posns[s];
 	for (i = 1; i <= *p; i++) {
-		if ((k = f->re[p[i]].ltype) != FINAL) {
-			if ((k == CHAR && c == ptoi(f->re[p[i]].lval.np))
-			 || (k == DOT && c != 0 && c != HAT)
-			 || (k == ALL && c != 0)
-			 || (k == EMPTYRE && c != 0)
-			 || (k == CCL && member(c, (char *) f->re[p[i]].lval.up))
-			 || (k == NCCL && !member(c, (char *) f->re[p[i]].lval.up) && c != 0 && c != HAT)) {
-				q = f->re[p[i]].lfollow;
-				for (j = 1; j <= *q; j++) {
-					if (q[j] >= maxsetvec) {
-						maxsetvec *= 4;
-						setvec = (int *) realloc(setvec, maxsetvec * sizeof(int));
-						tmpset = (int *) realloc(tmpset, maxsetvec * sizeof(int));
-						if (setvec == 0 || tmpset == 0)
-							overflo("cgoto overflow");
-					}
-					if (setvec[q[j]] == 0) {
-						setcnt++;
-						setvec[q[j]] = 1;
-					}
+		if (leafmatch(f, p[i], c)) {
+			q = f->re[p[i]].lfollow;
+			for (j = 1; j <= *q; j++) {
+				if (q[j] >= maxsetvec) {
+					maxsetvec *= 4;
+					setvec = (int *) realloc(setvec, maxsetvec * sizeof(int));
+					tmpset = (int *) realloc(tmpset, maxsetvec * sizeof(int));
+					if (setvec == 0 || tmpset == 0)
+						overflo("cgoto overflow");
+				}
+				if (setvec[q[j]] == 0) {
+					setcnt++;
+					setvec[q[j]] = 1;
 				}
 			}
 		}
@@ -901,41 +1474,41 @@ int cgoto(fa *f, int s, int c)
 			tmpset[j++] = i;
 		}
 	/* tmpset == previous state? */
-	for (i = 1; i <= f->curstat; i++) {
+	k = f->nhash - 1;
+	for (h = sethash(tmpset) & k; (i = f->hashtab[h]) != 0; h = (h+1) & k) {
 		p = f->posns[i];
-		if ((k = tmpset[0]) != p[0])
-			goto different;
-		for (j = 1; j <= k; j++)
-			if (tmpset[j] != p[j])
-				goto different;
-		/* setvec is state i */
-		f->gototab[s][c] = i;
-		return i;
-	  different:;
+		if (p[0] == setcnt && memcmp(p+1, tmpset+1, setcnt * sizeof(int)) == 0) {
+			GOTO(f, s, c) = i;	/* setvec is state i */
+			return i;
+		}
 	}
 
 	/* add tmpset to current set of states */
-	if (f->curstat >= NSTATES-1) {
+	if (f->curstat >= f->nstates-1
+	  && 2 * f->nstates * ((f->ncls + setcnt + 1) * sizeof(int) + sizeof(int *) + 1) <= FAMEM)
+		growfa(f, 2 * f->nstates);
+	if (f->curstat >= f->nstates-1) {
 		f->curstat = 2;
 		f->reset = 1;
-		for (i = 2; i < NSTATES; i++)
+		f->usebits = f->bits != NULL;	/* from the next match on */
+		for (i = 2; i < f->nstates; i++)
 			xfree(f->posns[i]);
+		rehash(f);
 	} else
 		++(f->curstat);
-	for (i = 0; i < NCHARS; i++)
-		f->gototab[f->curstat][i] = 0;
+	memset(ROW(f, f->curstat), 0, f->ncls * sizeof(int));
 	xfree(f->posns[f->curstat]);
 	if ((p = (int *) calloc(1, (setcnt+1)*sizeof(int))) == NULL)
 		overflo("out of space in cgoto");
 
 	f->posns[f->curstat] = p;
-	f->gototab[s][c] = f->curstat;
+	GOTO(f, s, c) = f->curstat;
 	for (i = 0; i <= setcnt; i++)
 		p[i] = tmpset[i];
-	if (setvec[f->accept])
-		f->out[f->curstat] = 1;
-	else
-		f->out[f->curstat] = 0;
+	hashstate(f, f->curstat);
+	f->out[f->curstat] = isfinal(f, p);
+	if (f->seen != NULL)
+		f->seen[f->curstat] = 0;
 	return f->curstat;
 }
 
@@ -946,13 +1519,24 @@ void freefa(fa *f)	/* free a finite automaton */
 
 	if (f == NULL)
 		return;
-	for (i = 0; i <= f->curstat; i++)
+	for (i = 0; i < f->nstates; i++)
 		xfree(f->posns[i]);
+	xfree(f->posns);
+	xfree(f->gototab);
+	xfree(f->out);
+	xfree(f->hashtab);
+	xfree(f->seen);
 	for (i = 0; i <= f->accept; i++) {
 		xfree(f->re[i].lfollow);
 		if (f->re[i].ltype == CCL || f->re[i].ltype == NCCL)
 			xfree((f->re[i].lval.np));
 	}
 	xfree(f->restr);
+	xfree(f->lit);
+	if (f->bits != NULL) {
+		xfree(f->bits->cmask);
+		xfree(f->bits->fol);
+		xfree(f->bits);
+	}
 	xfree(f);
 }
@@ -48,13 +48,17 @@ Keyword keywords[] ={	/* keep sorted: binary searched */
 	{ "END",	XEND,		XEND },
 	{ "NF",		VARNF,		VARNF },
 	{ "and",	BIO_FAND,	BLTIN },
+	{ "asort",	BIO_FASORT,	BLTIN },
+	{ "asorti",	BIO_FASORTI,	BLTIN },
 	{ "atan2",	FATAN,		BLTIN },
+	{ "attach",	BIO_FATTACH,	BLTIN },
 	{ "break",	BREAK,		BREAK },
 	{ "close",	CLOSE,		CLOSE },
 	{ "continue",	CONTINUE,	CONTINUE },
 	{ "cos",	FCOS,		BLTIN },
 	{ "delete",	DELETE,		DELETE },
 	{ "do",		DO,		DO },
+	{ "dump",	BIO_FDUMP,	BLTIN },
 	{ "else",	ELSE,		ELSE },
 	{ "exit",	EXIT,		EXIT },
 	{ "exp",	FEXP,		BLTIN },
@@ -69,8 +73,11 @@ Keyword keywords[] ={	/* keep sorted: binary searched */
 	{ "in",		IN,		IN },
 	{ "index",	INDEX,		INDEX },
 	{ "int",	FINT,		BLTIN },
+	{ "kwmatch",	BIO_FKWMATCH,	BLTIN },
 	{ "length",	FLENGTH,	BLTIN },
+	{ "loadtab",	BIO_FLOADTAB,	BLTIN },
 	{ "log",	FLOG,		BLTIN },
+	{ "lru",	BIO_FLRU,	BLTIN },
 	{ "match",	MATCHFCN,	MATCHFCN },
 	{ "meanqual",	BIO_FMEANQUAL,		BLTIN },
 	{ "next",	NEXT,		NEXT },
@@ -84,6 +91,7 @@ Keyword keywords[] ={	/* keep sorted: binary searched */
 	{ "revcomp",BIO_FREVCOMP, BLTIN },
 	{ "reverse",BIO_FREVERSE, BLTIN },
 	{ "sin",	FSIN,		BLTIN },
+	{ "sorted",	BIO_FSORTED,	BLTIN },
 	{ "split",	SPLIT,		SPLIT },
 	{ "sprintf",	SPRINTF,	SPRINTF },
 	{ "sqrt",	FSQRT,		BLTIN },
@@ -199,7 +207,7 @@ int yylex(void)
 		if (isalpha(c) || c == '_')
 			return word(buf);
 		if (isdigit(c)) {
-			yylval.cp = setsymtab(buf, tostring(buf), atof(buf), CON|NUM, symtab);
+			yylval.cp = setsymtab(buf, buf, atof(buf), CON|NUM, symtab);
 			/* should this also have STR set? */
 			RET(NUMBER);
 		}
@@ -439,6 +447,7 @@ int string(void)
 	s = tostring(buf);
 	*bp++ = ' '; *bp++ = 0;
 	yylval.cp = setsymtab(buf, s, 0.0, CON|STR|DONTFREE, symtab);
+	free(s);	/* setsymtab kept its own copy */
 	RET(STRING);
 }
 
@@ -47,6 +47,7 @@ int	nfields	= MAXFLD;	/* last allocated slot for $i */
 
 int	donefld;	/* 1 = implies rec broken into fields */
 int	donerec;	/* 1 = record is valid (no flds have changed) */
+unsigned recgen;	/* 1 more each time $0 may have changed */
 
 int	lastfld	= 0;	/* last used field */
 int	argno	= 1;	/* current input argument number */
@@ -124,6 +125,7 @@ int getrec(char **pbuf, int *pbufsize, int isrecord)	/* get next input record */
 	if (isrecord) {
 		donefld = 0;
 		donerec = 1;
+		recgen++;
 	}
 	saveb0 = buf[0];
 	buf[0] = 0;
@@ -155,10 +157,8 @@ int getrec(char **pbuf, int *pbufsize, int isrecord)	/* get next input record */
 					xfree(fldtab[0]->sval);
 				fldtab[0]->sval = buf;	/* buf == record */
 				fldtab[0]->tval = REC | STR | DONTFREE;
-				if (is_number(fldtab[0]->sval)) {
-					fldtab[0]->fval = atof(fldtab[0]->sval);
+				if (is_valid_number(fldtab[0]->sval, &fldtab[0]->fval))
 					fldtab[0]->tval |= NUM;
-				}
 			}
 			setfval(nrloc, nrloc->fval+1);
 			setfval(fnrloc, fnrloc->fval+1);
@@ -254,10 +254,8 @@ void setclvar(char *s)	/* set var=value from s */
 	p = qstring(p, '\0');
 	q = setsymtab(s, p, 0.0, STR, symtab);
 	setsval(q, p);
-	if (is_number(q->sval)) {
-		q->fval = atof(q->sval);
+	if (is_valid_number(q->sval, &q->fval))
 		q->tval |= NUM;
-	}
 	   dprintf( ("command line set %s to |%s|\n", s, p) );
 }
 
@@ -352,10 +350,8 @@ void fldbld(void)	/* create fields from current record */
 	donefld = 1;
 	for (j = 1; j <= lastfld; j++) {
 		p = fldtab[j];
-		if(is_number(p->sval)) {
-			p->fval = atof(p->sval);
+		if (is_valid_number(p->sval, &p->fval))
 			p->tval |= NUM;
-		}
 	}
 	setfval(nfloc, (Awkfloat) lastfld);
 	if (dbg) {
@@ -693,16 +689,50 @@ int isclvar(const char *s)	/* is s of form var=something ? */
 #include <math.h>
 int is_number(const char *s)
 {
+	return is_valid_number(s, NULL);
+}
+
+/* is_valid_number validates s and, if it is a number, stores its value */
+/* in *result in the same scan.  plain decimal integers (the bulk of */
+/* POS, FLAG, start/end columns) are converted here; anything with a */
+/* fraction, exponent, hex prefix, etc. falls back to strtod. */
+
+#define	MAXINTDIG	18	/* 10^18 fits in unsigned long long */
+
+int is_valid_number(const char *s, Awkfloat *result)
+{
+	const uschar *p = (const uschar *) s;
+	unsigned long long v;
+	int n, neg = 0;
 	double r;
 	char *ep;
+
+	while (isspace(*p))
+		p++;
+	if (*p == '-' || *p == '+')
+		neg = *p++ == '-';
+	for (v = 0, n = 0; isdigit(*p) && n < MAXINTDIG; p++, n++)
+		v = 10 * v + (*p - '0');
+	if (n > 0 && !isdigit(*p)) {
+		while (*p == ' ' || *p == '\t' || *p == '\n')
+			p++;
+		if (*p == '\0') {	/* integer; (double) v rounds like strtod */
+			if (result != NULL)
+				*result = neg ? -(double) v : (double) v;
+			return 1;
+		}
+		if (*p != '.' && *p != 'e' && *p != 'E' && *p != 'x' && *p != 'X')
+			return 0;	/* digits followed by junk */
+	}
 	errno = 0;
 	r = strtod(s, &ep);
 	if (ep == s || r == HUGE_VAL || errno == ERANGE)
 		return 0;
 	while (*ep == ' ' || *ep == '\t' || *ep == '\n')
 		ep++;
-	if (*ep == '\0')
-		return 1;
-	else
+	if (*ep != '\0')
 		return 0;
+	if (result != NULL)
+		*result = r;
+	return 1;
 }
@@ -31,6 +31,9 @@ const char	*version = "version 20110810";
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#ifdef __GLIBC__
+#include <malloc.h>	/* mallopt */
+#endif
 #include "awk.h"
 #include "ytab.h"
 
@@ -54,18 +57,59 @@ int	curpfile = 0;	/* current filename */
 
 int	safe	= 0;	/* 1 => "safe" mode */
 
+#ifndef AOT	/* else they are in a program made by bioawk --emit-c */
+char	*aotprog = NULL;	/* the program, compiled in */
+Ncode	*aotcode = NULL;	/* and its code, compiled to C */
+#endif
+
+static long long getsize(const char *s)	/* 100, 64k, 8G, ... in bytes */
+{
+	char *ep;
+	long long n;
+
+	n = strtoll(s, &ep, 10);
+	switch (*ep) {
+	case 'k': case 'K': n <<= 10; ep++; break;
+	case 'm': case 'M': n <<= 20; ep++; break;
+	case 'g': case 'G': n <<= 30; ep++; break;
+	}
+	if (n <= 0 || ep == s || *ep != 0)
+		FATAL("invalid size %s", s);
+	return n;
+}
+
+static char *readprog(void)	/* the text of the -f files, for --emit-c */
+{
+	char *s = NULL;
+	int c, n = 0, sz = 0;
+
+	do {
+		if (n >= sz) {
+			sz = sz ? 2 * sz : 4096;
+			if ((s = (char *) realloc(s, sz)) == NULL)
+				FATAL("out of space reading program");
+		}
+		s[n++] = c = pgetc();
+	} while (c != EOF);
+	s[n-1] = '\0';
+	npfile = curpfile = 0;	/* from now on it's as if it were 'prog' */
+	return s;
+}
+
 int main(int argc, char *argv[])
 {
 	const char *fs = NULL;
-	char tmp[16];
+	char tmp[16], *prog = NULL;
+	int emitc = 0;
 	
 	setlocale(LC_CTYPE, "");
 	setlocale(LC_NUMERIC, "C"); /* for parsing cmdline & prog */
 	cmdname = argv[0];
-	if (argc == 1) {
+	if (argc == 1 && aotprog == NULL) {
 		fprintf(stderr, 
-		  "usage: %s [-F fs] [-v var=value] [-c fmt] [-tH] [-f progfile | 'prog'] [file ...]\n", 
-		  cmdname);
+		  "usage: %s [-F fs] [-v var=value] [-c fmt] [-M size] [-tH] [-f progfile | 'prog'] [file ...]\n"
+		  "       %s --emit-c progfile > prog.c\n", 
+		  cmdname, cmdname);
 		exit(1);
 	}
 	signal(SIGFPE, fpecatch);
@@ -81,6 +125,17 @@ int main(int argc, char *argv[])
 			exit(0);
 			break;
 		}
+		if (strcmp(argv[1], "--emit-c") == 0) {	/* next arg is program to compile to C */
+			argc--; argv++;
+			if (argc <= 1)
+				FATAL("no program filename");
+			if (npfile >= MAX_PFILE - 1)
+				FATAL("too many -f options"); 
+			pfile[npfile++] = argv[1];
+			emitc = 1;
+			argc--; argv++;
+			continue;
+		}
 		if (strncmp(argv[1], "--", 2) == 0) {	/* explicit end of args */
 			argc--;
 			argv++;
@@ -150,6 +205,16 @@ int main(int argc, char *argv[])
 		case 'H':
 			bio_flag |= BIO_SHOW_HDR;
 			break;
+		case 'M':	/* memory for arrays, e.g. -M 8G; the rest spills to disk */
+			if (argv[1][2] != 0)	/* arg is -Msize */
+				arraybudget = getsize(&argv[1][2]);
+			else {		/* arg is -M size */
+				argc--; argv++;
+				if (argc <= 1)
+					FATAL("no size for -M");
+				arraybudget = getsize(argv[1]);
+			}
+			break;
 		case 'c':
 			if (argv[1][2] != 0) {	/* arg is -csomething */
 				if ((bio_fmt = bio_get_fmt(&argv[1][2])) == BIO_NULL) return 1;
@@ -171,7 +236,11 @@ int main(int argc, char *argv[])
 		} else --argc, ++argv;
 	}
 	/* argv[1] is now the first argument */
-	if (npfile == 0) {	/* no -f; first argument is program */
+	if (aotprog != NULL) {	/* compiled in by bioawk --emit-c */
+		if (npfile > 0)
+			FATAL("the program is compiled in; no -f allowed");
+		lexprog = aotprog;
+	} else if (npfile == 0) {	/* no -f; first argument is program */
 		if (argc <= 1) {
 			if (dbg)
 				exit(0);
@@ -182,6 +251,12 @@ int main(int argc, char *argv[])
 		argc--;
 		argv++;
 	}
+	if (emitc)
+		lexprog = prog = readprog();
+#ifdef M_MMAP_THRESHOLD
+	if (arraybudget > 0)	/* big array tables go back to the system when freed, */
+		mallopt(M_MMAP_THRESHOLD, 256 * 1024);	/* not stranded in the heap */
+#endif
 	recinit(recsize);
 	syminit();
 	compile_time = 1;
@@ -197,7 +272,10 @@ int main(int argc, char *argv[])
 	   dprintf( ("errorflag=%d\n", errorflag) );
 	if (errorflag == 0) {
 		compile_time = 0;
-		run(winner);
+		if (emitc)
+			vmemit(winner, prog);
+		else
+			run(winner);
 	} else
 		bracecheck();
 	return(errorflag);
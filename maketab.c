@@ -103,6 +103,7 @@ struct xx
 	{ ARG, "arg", "arg" },
 	{ VARNF, "getnf", "NF" },
 	{ GETLINE, "awkgetline", "getline" },
+	{ CODE, "vmrun", "code" },
 	{ 0, "", "" },
 };
 
@@ -191,7 +191,8 @@ Node *makearr(Node *p)
 		if (isfcn(cp))
 			SYNTAX( "%s is a function, not an array", cp->nval );
 		else if (!isarr(cp)) {
-			xfree(cp->sval);
+			if (freeable(cp))
+				xfree(cp->sval);
 			cp->sval = (char *) makesymtab(NSYMTAB);
 			cp->tval = ARR;
 		}
@@ -245,7 +246,7 @@ void defn(Cell *v, Node *vl, Node *st)	/* turn on FCN bit in definition, */
 	}
 
 	v->tval = FCN;
-	v->sval = (char *) st;
+	v->sval = (char *) vmcompile(st);
 	n = 0;	/* count arguments */
 	for (p = vl; p; p = p->nnext)
 		n++;
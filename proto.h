@@ -40,6 +40,7 @@ extern	int	yyinput(void);
 
 extern	fa	*makedfa(const char *, int);
 extern	fa	*mkdfa(const char *, int);
+extern	fa	*mkmulti(char **, int);
 extern	int	makeinit(fa *, int);
 extern	void	penter(Node *);
 extern	void	freetr(Node *);
@@ -54,6 +55,7 @@ extern	int	member(int, const char *);
 extern	int	match(fa *, const char *);
 extern	int	pmatch(fa *, const char *);
 extern	int	nematch(fa *, const char *);
+extern	int	multimatch(fa *, const char *, uschar *);
 extern	Node	*reparse(const char *);
 extern	Node	*regexp(void);
 extern	Node	*primary(void);
@@ -100,15 +102,33 @@ extern	Array	*makesymtab(int);
 extern	void	freesymtab(Cell *);
 extern	void	freeelem(Cell *, const char *);
 extern	Cell	*setsymtab(const char *, const char *, double, unsigned int, Array *);
-extern	int	hash(const char *, int);
-extern	void	rehash(Array *);
+extern	unsigned long long	hash(const char *);
 extern	Cell	*lookup(const char *, Array *);
+extern	int	inarray(const char *, Array *);
+extern	void	arraycheck(void);
+extern	long long	spillend(Array *);
+extern	char	*spillnext(Array *, long long *);
+extern	int	mapped(Array *, const char *);
+extern	char	*mapnext(Array *, long long *);
+extern	long long	dumparray(Array *, const char *);
+extern	long long	attacharray(Cell *, const char *);
+extern	void	arrayreserve(Array *, int);
+extern	void	arrayfilling(Array *, int);
+extern	void	unshadow(Array *);
+extern	void	lruarray(Cell *, int, Cell *);
+extern	Asort	*sortarray(Array *, const char *, int);
+extern	void	freesort(Asort *);
+extern	char	*sortedin(void);
+extern	int	asortarray(Cell *, Cell *, const char *, int);
 extern	double	setfval(Cell *, double);
 extern	void	funnyvar(Cell *, const char *);
 extern	char	*setsval(Cell *, const char *);
+extern	char	*adoptsval(Cell *, char *);
 extern	double	getfval(Cell *);
 extern	char	*getsval(Cell *);
 extern	char	*getpssval(Cell *);     /* for print */
+extern	int	itos(char *, long long);
+extern	char	*fmtnum(char *, Awkfloat, const char *);
 extern	char	*tostring(const char *);
 extern	char	*qstring(const char *, int);
 
@@ -140,12 +160,14 @@ extern	void	bclass(int);
 extern	double	errcheck(double, const char *);
 extern	int	isclvar(const char *);
 extern	int	is_number(const char *);
+extern	int	is_valid_number(const char *, Awkfloat *);
 
 extern	int	adjbuf(char **pb, int *sz, int min, int q, char **pbp, const char *what);
 extern	void	run(Node *);
 extern	Cell	*execute(Node *);
 extern	Cell	*program(Node **, int);
 extern	Cell	*call(Node **, int);
+extern	Awkfloat	callfcn(Cell *, Cell **, int);
 extern	Cell	*copycell(Cell *);
 extern	Cell	*arg(Node **, int);
 extern	Cell	*jump(Node **, int);
@@ -159,6 +181,8 @@ extern	Cell	*boolop(Node **, int);
 extern	Cell	*relop(Node **, int);
 extern	void	tfree(Cell *);
 extern	Cell	*gettemp(void);
+extern	char	*tempsval(Cell *, int);
+extern	void	tempreset(void);
 extern	Cell	*field(Node **, int);
 extern	Cell	*indirect(Node **, int);
 extern	Cell	*substr(Node **, int);
@@ -191,5 +215,15 @@ extern	void	closeall(void);
 extern	Cell	*sub(Node **, int);
 extern	Cell	*gsub(Node **, int);
 
+extern	Node	*vmcompile(Node *);
+extern	Cell	*vmrun(Node **, int);
+extern	void	vmemit(Node *, char *);
+extern	Cell	*vmcell(Vslot *);
+extern	Cell	*vmfield(Cell *);
+extern	Cell	*vmfldk(int);
+extern	int	vmcmp(Vslot *, Vslot *);
+extern	Cell	*vmasgn(int, Cell *, Vslot *, Node *);
+extern	Cell	*vmstat(Node *);
+
 extern	FILE	*popen(const char *, const char *);
 extern	int	pclose(FILE *);
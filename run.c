@@ -131,6 +131,7 @@ void run(Node *a)	/* execution of parse tree starts here */
 	extern void stdinit(void);
 
 	stdinit();
+	vmcompile(a);
 	execute(a);
 	closeall();
 }
@@ -172,6 +173,88 @@ Cell *execute(Node *u)	/* execute a node of the parse tree */
 }
 
 
+/*
+ * a body of many /re/ { ... } rules would run each re over $0 in
+ * turn.  instead their re's are made into one dfa (see mkmulti in
+ * b.c) that tells at once which of the rules match, and only their
+ * actions are run, in order.  an action that changes $0 or a field
+ * bumps recgen, and the rules after it are matched against the new $0.
+ */
+
+#define	NMULTI	8	/* fewer /re/ rules than this are matched one by one */
+
+static	fa	*multifa;	/* the re's of all the /re/ rules in the body */
+static	Node	**mrule;	/* the PASTAT of each, in order */
+static	uschar	*mhit;		/* rule i matches the current $0 */
+
+static int isrerule(Node *a)	/* is a /re/ { ... } on $0? */
+{
+	extern Cell *literal0;
+	Node *p;
+
+	if (a->nobj != PASTAT || (p = a->narg[0]) == NULL)
+		return 0;
+	if (p->nobj != MATCH || p->narg[0] != NULL || p->narg[1]->nobj != INDIRECT)
+		return 0;
+	p = p->narg[1]->narg[0];
+	return isvalue(p) && (Cell *) p->narg[0] == literal0;
+}
+
+static void mkrules(Node *u)	/* set up multifa for the body u */
+{
+	Node *a;
+	char **re;
+	int n;
+
+	n = 0;
+	for (a = u; a != NULL; a = a->nnext)
+		if (isrerule(a))
+			n++;
+	if (n < NMULTI)
+		return;
+	re = (char **) malloc(n * sizeof(char *));
+	mrule = (Node **) malloc(n * sizeof(Node *));
+	mhit = (uschar *) malloc(n);
+	if (re == NULL || mrule == NULL || mhit == NULL)
+		FATAL("out of space for %d rules", n);
+	n = 0;
+	for (a = u; a != NULL; a = a->nnext)
+		if (isrerule(a)) {
+			mrule[n] = a;
+			re[n++] = (char *) ((fa *) a->narg[0]->narg[2])->restr;
+		}
+	multifa = mkmulti(re, n);
+	free(re);
+}
+
+static Cell *dorules(Node *u)	/* execute the body u by way of multifa */
+{
+	Cell *x;
+	Node *a;
+	int i;
+	unsigned gen;
+
+	gen = recgen - 1;	/* nothing matched yet */
+	i = 0;
+	for (a = u; ; a = a->nnext) {
+		curnode = a;
+		if (i < multifa->nrule && a == mrule[i]) {
+			if (gen != recgen) {	/* a new or changed $0 */
+				x = execute(a->narg[0]->narg[1]);
+				memset(mhit, 0, multifa->nrule);
+				multimatch(multifa, getsval(x), mhit);
+				tempfree(x);
+				gen = recgen;
+			}
+			x = mhit[i++] ? execute(a->narg[1]) : False;
+		} else
+			x = (*proctab[a->nobj-FIRSTTOKEN])(a->narg, a->nobj);
+		if (isjump(x) || a->nnext == NULL)
+			return(x);
+		tempfree(x);
+	}
+}
+
 Cell *program(Node **a, int n)	/* execute an awk program */
 {				/* a[0] = BEGIN, a[1] = body, a[2] = END */
 	Cell *x;
@@ -188,10 +271,12 @@ Cell *program(Node **a, int n)	/* execute an awk program */
 	}
 	if (a[1] || a[2]) {
 		if (bio_fmt > BIO_HDR) bio_set_colnm();
-		while (getrec(&record, &recsize, 1) > 0) {
+		if (a[1])
+			mkrules(a[1]);
+		while (tempreset(), arraycheck(), getrec(&record, &recsize, 1) > 0) {
 			if (bio_skip_hdr(record)) continue;
 			if (bio_fmt == BIO_HDR && (int)(*NR + .499) == 1) bio_set_colnm();
-			x = execute(a[1]);
+			x = multifa != NULL ? dorules(a[1]) : execute(a[1]);
 			if (isexit(x))
 				break;
 			tempfree(x);
@@ -200,11 +285,13 @@ Cell *program(Node **a, int n)	/* execute an awk program */
   ex:
 	if (setjmp(env) != 0)	/* handles exit within END */
 		goto ex1;
+	arraycheck();
 	if (a[2]) {		/* END */
 		x = execute(a[2]);
 		if (isbreak(x) || isnext(x) || iscont(x))
 			FATAL("illegal break, continue, next or nextfile from END");
 		tempfree(x);
+		arraycheck();
 	}
   ex1:
 	return(True);
@@ -223,6 +310,10 @@ struct Frame *frame = NULL;	/* base of stack frames; dynamically allocated */
 int	nframe = 0;		/* number of frames allocated */
 struct Frame *fp = NULL;	/* frame pointer. bottom level unused */
 
+/* between turns of a loop outside any function, nothing holds on to */
+/* an array element, so -M may move some out of memory */
+#define	loopcheck()	(fp == frame ? arraycheck() : (void) 0)
+
 Cell *call(Node **a, int n)	/* function call.  very kludgy and fragile */
 {
 	static Cell newcopycell = { OCELL, CCOPY, 0, "", 0.0, NUM|STR|DONTFREE };
@@ -297,7 +388,7 @@ Cell *call(Node **a, int n)	/* function call.  very kludgy and fragile */
 					tempfree(t);
 				} else {
 					oargs[i]->tval = t->tval;
-					oargs[i]->tval &= ~(STR|NUM|DONTFREE);
+					oargs[i]->tval &= ~(STR|NUM|DONTFREE|CONV);
 					oargs[i]->sval = t->sval;
 					tempfree(t);
 				}
@@ -323,6 +414,35 @@ Cell *call(Node **a, int n)	/* function call.  very kludgy and fragile */
 	return(z);
 }
 
+Awkfloat callfcn(Cell *fcn, Cell **v, int n)	/* fcn(v[0], ..., v[n-1]) from C */
+{
+	static Node *f, *arg[4];	/* n <= 4 */
+	Node *na[2];
+	Cell *r;
+	Awkfloat d;
+	int i;
+
+	if (f == NULL) {	/* value nodes, as celltonode makes, minus its csub */
+		f = node1(0, NULL);
+		f->ntype = NVALUE;
+		for (i = 0; i < 4; i++) {
+			arg[i] = node1(0, NULL);
+			arg[i]->ntype = NVALUE;
+		}
+	}
+	f->narg[0] = (Node *) fcn;
+	for (i = 0; i < n; i++) {
+		arg[i]->narg[0] = (Node *) v[i];
+		arg[i]->nnext = i + 1 < n ? arg[i+1] : NULL;
+	}
+	na[0] = f;
+	na[1] = n > 0 ? arg[0] : NULL;
+	r = call(na, 0);
+	d = getfval(r);
+	tempfree(r);
+	return d;
+}
+
 Cell *copycell(Cell *x)	/* make a copy of a cell in a temp */
 {
 	Cell *y;
@@ -330,11 +450,17 @@ Cell *copycell(Cell *x)	/* make a copy of a cell in a temp */
 	y = gettemp();
 	y->csub = CCOPY;	/* prevents freeing until call is over */
 	y->nval = x->nval;	/* BUG? */
-	if (isstr(x))
-		y->sval = tostring(x->sval);
-	y->fval = x->fval;
 	y->tval = x->tval & ~(CON|FLD|REC|DONTFREE);	/* copy is not constant or field */
 							/* is DONTFREE right? */
+	if (isstr(x)) {
+		if (strlen(x->sval) < sizeof(y->nbuf)) {
+			y->sval = strcpy(y->nbuf, x->sval);
+			y->tval |= DONTFREE;
+		} else
+			y->sval = tostring(x->sval);
+	}
+	y->fval = x->fval;
+	y->cfmt = x->cfmt;
 	return y;
 }
 
@@ -364,15 +490,15 @@ Cell *jump(Node **a, int n)	/* break, continue, next, nextfile, return */
 	case RETURN:
 		if (a[0] != NULL) {
 			y = execute(a[0]);
-			if ((y->tval & (STR|NUM)) == (STR|NUM)) {
+			if ((y->tval & (STR|NUM|CONV)) == (STR|NUM)) {
 				setsval(fp->retval, getsval(y));
 				fp->retval->fval = getfval(y);
 				fp->retval->tval |= NUM;
 			}
-			else if (y->tval & STR)
-				setsval(fp->retval, getsval(y));
 			else if (y->tval & NUM)
 				setfval(fp->retval, getfval(y));
+			else if (y->tval & STR)
+				setsval(fp->retval, getsval(y));
 			else		/* can't happen */
 				FATAL("bad type variable %d", y->tval);
 			tempfree(y);
@@ -426,10 +552,8 @@ Cell *awkgetline(Node **a, int n)	/* get next line from specific input */
 			tempfree(x);
 		} else {			/* getline <file */
 			setsval(fldtab[0], buf);
-			if (is_number(fldtab[0]->sval)) {
-				fldtab[0]->fval = atof(fldtab[0]->sval);
+			if (is_valid_number(fldtab[0]->sval, &fldtab[0]->fval))
 				fldtab[0]->tval |= NUM;
-			}
 		}
 	} else {			/* bare getline; use current input */
 		if (a[0] == NULL)	/* getline */
@@ -453,79 +577,106 @@ Cell *getnf(Node **a, int n)	/* get NF */
 	return (Cell *) a[0];
 }
 
+/*
+ * subscripts are built without allocating.  a lone subscript is used
+ * where it stands, and a number is formatted into the caller's
+ * nbuf.  lists a[i,j] are joined with SUBSEP in subbuf, starting at
+ * subtop; a subscript may itself index an array, so each caller saves
+ * subtop beforehand and puts it back once it is done with the string.
+ */
+
+static char	*subbuf	= NULL;	/* scratch for a[i,j,...] subscripts */
+static int	subsz	= 0;
+static int	subtop	= 0;	/* subbuf below here belongs to outer calls */
+
+static char *subval(Cell *y, char *nbuf)	/* string value of subscript y */
+{
+	if ((y->tval & (NUM|STR)) == NUM)	/* no need to cache it in y */
+		return fmtnum(nbuf, y->fval, *CONVFMT);
+	return getsval(y);
+}
+
+static char *subscript(Node *np, char *nbuf, Cell **yp)	/* subscript list np */
+{
+	Cell *y;
+	char *s;
+	int base, len, nsub;
+
+	if (np->nnext == NULL) {	/* the usual case */
+		*yp = y = execute(np);
+		return subval(y, nbuf);
+	}
+	*yp = NULL;
+	nsub = strlen(*SUBSEP);
+	base = subtop;
+	for ( ; np; np = np->nnext) {
+		y = execute(np);	/* may use subbuf above subtop */
+		s = subval(y, nbuf);
+		len = strlen(s);
+		if (!adjbuf(&subbuf, &subsz, subtop+len+nsub+1, recsize, 0, 0))
+			FATAL("out of memory for subscript %.30s...", s);
+		memcpy(subbuf+subtop, s, len);
+		subtop += len;
+		if (np->nnext) {
+			memcpy(subbuf+subtop, *SUBSEP, nsub);
+			subtop += nsub;
+		}
+		tempfree(y);
+	}
+	subbuf[subtop++] = 0;
+	return subbuf + base;
+}
+
 Cell *array(Node **a, int n)	/* a[0] is symtab, a[1] is list of subscripts */
 {
 	Cell *x, *y, *z;
 	char *s;
-	Node *np;
-	char *buf;
-	int bufsz = recsize;
-	int nsub = strlen(*SUBSEP);
-
-	if ((buf = (char *) malloc(bufsz)) == NULL)
-		FATAL("out of memory in array");
+	char nbuf[NUMBUFSZ];
+	int otop = subtop;
 
 	x = execute(a[0]);	/* Cell* for symbol table */
-	buf[0] = 0;
-	for (np = a[1]; np; np = np->nnext) {
-		y = execute(np);	/* subscript */
-		s = getsval(y);
-		if (!adjbuf(&buf, &bufsz, strlen(buf)+strlen(s)+nsub+1, recsize, 0, "array"))
-			FATAL("out of memory for %s[%s...]", x->nval, buf);
-		strcat(buf, s);
-		if (np->nnext)
-			strcat(buf, *SUBSEP);
-		tempfree(y);
-	}
+	s = subscript(a[1], nbuf, &y);
 	if (!isarr(x)) {
 		   dprintf( ("making %s into an array\n", NN(x->nval)) );
 		if (freeable(x))
 			xfree(x->sval);
-		x->tval &= ~(STR|NUM|DONTFREE);
+		x->tval &= ~(STR|NUM|DONTFREE|CONV);
 		x->tval |= ARR;
 		x->sval = (char *) makesymtab(NSYMTAB);
 	}
-	z = setsymtab(buf, "", 0.0, STR|NUM, (Array *) x->sval);
+	z = setsymtab(s, "", 0.0, STR|NUM, (Array *) x->sval);
 	z->ctype = OCELL;
 	z->csub = CVAR;
+	if (y != NULL) {
+		tempfree(y);
+	}
+	subtop = otop;
 	tempfree(x);
-	free(buf);
 	return(z);
 }
 
 Cell *awkdelete(Node **a, int n)	/* a[0] is symtab, a[1] is list of subscripts */
 {
 	Cell *x, *y;
-	Node *np;
 	char *s;
-	int nsub = strlen(*SUBSEP);
+	char nbuf[NUMBUFSZ];
+	int otop = subtop;
 
 	x = execute(a[0]);	/* Cell* for symbol table */
 	if (!isarr(x))
 		return True;
 	if (a[1] == 0) {	/* delete the elements, not the table */
 		freesymtab(x);
-		x->tval &= ~STR;
+		x->tval &= ~(STR|CONV);
 		x->tval |= ARR;
 		x->sval = (char *) makesymtab(NSYMTAB);
 	} else {
-		int bufsz = recsize;
-		char *buf;
-		if ((buf = (char *) malloc(bufsz)) == NULL)
-			FATAL("out of memory in adelete");
-		buf[0] = 0;
-		for (np = a[1]; np; np = np->nnext) {
-			y = execute(np);	/* subscript */
-			s = getsval(y);
-			if (!adjbuf(&buf, &bufsz, strlen(buf)+strlen(s)+nsub+1, recsize, 0, "awkdelete"))
-				FATAL("out of memory deleting %s[%s...]", x->nval, buf);
-			strcat(buf, s);	
-			if (np->nnext)
-				strcat(buf, *SUBSEP);
+		s = subscript(a[1], nbuf, &y);
+		freeelem(x, s);
+		if (y != NULL) {
 			tempfree(y);
 		}
-		freeelem(x, buf);
-		free(buf);
+		subtop = otop;
 	}
 	tempfree(x);
 	return True;
@@ -533,40 +684,28 @@ Cell *awkdelete(Node **a, int n)	/* a[0] is symtab, a[1] is list of subscripts *
 
 Cell *intest(Node **a, int n)	/* a[0] is index (list), a[1] is symtab */
 {
-	Cell *x, *ap, *k;
-	Node *p;
-	char *buf;
+	Cell *x, *ap;
 	char *s;
-	int bufsz = recsize;
-	int nsub = strlen(*SUBSEP);
+	char nbuf[NUMBUFSZ];
+	int k, otop = subtop;
 
 	ap = execute(a[1]);	/* array name */
 	if (!isarr(ap)) {
 		   dprintf( ("making %s into an array\n", ap->nval) );
 		if (freeable(ap))
 			xfree(ap->sval);
-		ap->tval &= ~(STR|NUM|DONTFREE);
+		ap->tval &= ~(STR|NUM|DONTFREE|CONV);
 		ap->tval |= ARR;
 		ap->sval = (char *) makesymtab(NSYMTAB);
 	}
-	if ((buf = (char *) malloc(bufsz)) == NULL) {
-		FATAL("out of memory in intest");
-	}
-	buf[0] = 0;
-	for (p = a[0]; p; p = p->nnext) {
-		x = execute(p);	/* expr */
-		s = getsval(x);
-		if (!adjbuf(&buf, &bufsz, strlen(buf)+strlen(s)+nsub+1, recsize, 0, "intest"))
-			FATAL("out of memory deleting %s[%s...]", x->nval, buf);
-		strcat(buf, s);
+	s = subscript(a[0], nbuf, &x);
+	k = inarray(s, (Array *) ap->sval);
+	if (x != NULL) {
 		tempfree(x);
-		if (p->nnext)
-			strcat(buf, *SUBSEP);
 	}
-	k = lookup(buf, (Array *) ap->sval);
+	subtop = otop;
 	tempfree(ap);
-	free(buf);
-	if (k == NULL)
+	if (k == 0)
 		return(False);
 	else
 		return(True);
@@ -658,7 +797,9 @@ Cell *relop(Node **a, int n)	/* a[0 < a[1], etc. */
 		j = x->fval - y->fval;
 		i = j<0? -1: (j>0? 1: 0);
 	} else {
-		i = strcmp(getsval(x), getsval(y));
+		char *s1 = getsval(x), *s2 = getsval(y);
+
+		i = s1 == s2 ? 0 : strcmp(s1, s2);
 	}
 	tempfree(x);
 	tempfree(y);
@@ -711,6 +852,71 @@ Cell *gettemp(void)	/* get a tempcell */
 	return(x);
 }
 
+/*
+ * strings made for temps by cat, substr and the like come from an arena
+ * that program() empties before reading each record.  temps never live
+ * from one record to the next, and anything stored into a variable,
+ * field or array element is copied by setsval, so nothing escapes.
+ * BEGIN and END get the arena too but never empty it; past ARENAMAX,
+ * or for strings too big to be worth it, tempsval falls back on malloc.
+ */
+
+#define	ARENACHUNK	65536
+#define	ARENAMAX	(256*ARENACHUNK)
+
+static char	**arena;	/* chunks, kept from one record to the next */
+static int	narena	= 0;	/* chunks allocated */
+static int	curarena = 0;	/* chunk in use */
+static int	arenaused = 0;	/* bytes used in arena[curarena] */
+
+static char *arenaalloc(int n)	/* n bytes from the arena, or NULL */
+{
+	char *p;
+
+	if (n > ARENACHUNK/4)
+		return NULL;
+	if (narena == 0 || arenaused + n > ARENACHUNK) {
+		if (narena > 0 && curarena+1 < narena)
+			curarena++;
+		else if (narena < ARENAMAX/ARENACHUNK) {
+			arena = (char **) realloc(arena, (narena+1) * sizeof(char *));
+			if (arena == NULL || (arena[narena] = (char *) malloc(ARENACHUNK)) == NULL)
+				FATAL("out of space for temporary strings");
+			curarena = narena++;
+		} else
+			return NULL;
+		arenaused = 0;
+	}
+	p = arena[curarena] + arenaused;
+	arenaused += n;
+	return p;
+}
+
+void tempreset(void)	/* forget all arena strings; no temps may be live */
+{
+	curarena = 0;
+	arenaused = 0;
+}
+
+char *tempsval(Cell *x, int n)	/* room for an n-byte string value in temp x */
+{
+	char *s;
+
+	if (freeable(x))
+		xfree(x->sval);
+	x->tval &= ~(NUM|CONV);
+	if (x->csub == CTEMP && (s = arenaalloc(n+1)) != NULL)
+		x->tval |= STR|DONTFREE;
+	else {
+		if ((s = (char *) malloc(n+1)) == NULL)
+			FATAL("out of space for a string of length %d", n);
+		x->tval &= ~DONTFREE;
+		x->tval |= STR;
+	}
+	s[n] = '\0';
+	return x->sval = s;
+}
+
 Cell *indirect(Node **a, int n)	/* $( a[0] ) */
 {
 	Awkfloat val;
@@ -737,7 +943,6 @@ Cell *substr(Node **a, int nnn)		/* substr(a[0], a[1], a[2]) */
 {
 	int k, m, n;
 	char *s;
-	int temp;
 	Cell *x, *y, *z = 0;
 
 	x = execute(a[0]);
@@ -753,7 +958,7 @@ Cell *substr(Node **a, int nnn)		/* substr(a[0], a[1], a[2]) */
 			tempfree(z);
 		}
 		x = gettemp();
-		setsval(x, "");
+		tempsval(x, 0);
 		return(x);
 	}
 	m = (int) getfval(y);
@@ -773,10 +978,7 @@ Cell *substr(Node **a, int nnn)		/* substr(a[0], a[1], a[2]) */
 		n = k - m;
 	   dprintf( ("substr: m=%d, n=%d, s=%s\n", m, n, s) );
 	y = gettemp();
-	temp = s[n+m-1];	/* with thanks to John Linderman */
-	s[n+m-1] = '\0';
-	setsval(y, s + m - 1);
-	s[n+m-1] = temp;
+	memcpy(tempsval(y, n), s + m - 1, n);
 	tempfree(x);
 	return(y);
 }
@@ -946,21 +1148,32 @@ int format(char **pbuf, int *pbufsize, const char *s, Node *a)	/* printf-like co
 
 Cell *awksprintf(Node **a, int n)		/* sprintf(a[0]) */
 {
+	static char *sbuf = NULL;	/* reused unless sprintf is nested */
+	static int sbufsz = 0, sbusy = 0;
 	Cell *x;
 	Node *y;
 	char *buf;
-	int bufsz=3*recsize;
+	int bufsz=3*recsize, len, mine;
 
-	if ((buf = (char *) malloc(bufsz)) == NULL)
+	if ((mine = !sbusy) && sbuf != NULL) {
+		buf = sbuf;
+		bufsz = sbufsz;
+	} else if ((buf = (char *) malloc(bufsz)) == NULL)
 		FATAL("out of memory in awksprintf");
+	sbusy = 1;
 	y = a[0]->nnext;
 	x = execute(a[0]);
-	if (format(&buf, &bufsz, getsval(x), y) == -1)
+	if ((len = format(&buf, &bufsz, getsval(x), y)) == -1)
 		FATAL("sprintf string %.30s... too long.  can't happen.", buf);
 	tempfree(x);
 	x = gettemp();
-	x->sval = buf;
-	x->tval = STR;
+	memcpy(tempsval(x, len), buf, len);
+	if (mine) {
+		sbuf = buf;
+		sbufsz = bufsz;
+		sbusy = 0;
+	} else
+		free(buf);
 	return(x);
 }
 
@@ -1094,15 +1307,15 @@ Cell *assign(Node **a, int n)	/* a[0] = a[1], a[0] += a[1], etc. */
 	if (n == ASSIGN) {	/* ordinary assignment */
 		if (x == y && !(x->tval & (FLD|REC)))	/* self-assignment: */
 			;		/* leave alone unless it's a field */
-		else if ((y->tval & (STR|NUM)) == (STR|NUM)) {
+		else if ((y->tval & (STR|NUM|CONV)) == (STR|NUM)) {
 			setsval(x, getsval(y));
 			x->fval = getfval(y);
 			x->tval |= NUM;
 		}
+		else if (isnum(y))	/* string, if any, is only a conversion */
+			setfval(x, getfval(y));
 		else if (isstr(y))
 			setsval(x, getsval(y));
-		else if (isnum(y))
-			setfval(x, getfval(y));
 		else
 			funnyvar(y, "read value of");
 		tempfree(y);
@@ -1150,25 +1363,27 @@ Cell *cat(Node **a, int q)	/* a[0] cat a[1] */
 {
 	Cell *x, *y, *z;
 	int n1, n2;
-	char *s;
+	char *s, *s1, *s2;
+	char nb1[NUMBUFSZ], nb2[NUMBUFSZ];
 
 	x = execute(a[0]);
 	y = execute(a[1]);
-	getsval(x);
-	getsval(y);
-	n1 = strlen(x->sval);
-	n2 = strlen(y->sval);
-	s = (char *) malloc(n1 + n2 + 1);
-	if (s == NULL)
-		FATAL("out of space concatenating %.15s... and %.15s...",
-			x->sval, y->sval);
-	strcpy(s, x->sval);
-	strcpy(s+n1, y->sval);
+	if ((x->tval & (NUM|STR)) == NUM)	/* numbers need not be cached */
+		s1 = fmtnum(nb1, x->fval, *CONVFMT);
+	else
+		s1 = getsval(x);
+	if ((y->tval & (NUM|STR)) == NUM)
+		s2 = fmtnum(nb2, y->fval, *CONVFMT);
+	else
+		s2 = getsval(y);
+	n1 = strlen(s1);
+	n2 = strlen(s2);
+	z = gettemp();
+	s = tempsval(z, n1 + n2);
+	memcpy(s, s1, n1);
+	memcpy(s+n1, s2, n2);
 	tempfree(x);
 	tempfree(y);
-	z = gettemp();
-	z->sval = s;
-	z->tval = STR;
 	return(z);
 }
 
@@ -1218,6 +1433,7 @@ Cell *split(Node **a, int nnn)	/* split(a[0], a[1], a[2]); a[3] is type */
 	int sep;
 	char *t, temp, num[50], *fs = 0;
 	int n, tempstat, arg3type;
+	Awkfloat f;
 
 	y = execute(a[0]);	/* source string */
 	s = getsval(y);
@@ -1235,7 +1451,7 @@ Cell *split(Node **a, int nnn)	/* split(a[0], a[1], a[2]); a[3] is type */
 	ap = execute(a[1]);	/* array name */
 	freesymtab(ap);
 	   dprintf( ("split: s=|%s|, a=%s, sep=|%s|\n", s, NN(ap->nval), fs) );
-	ap->tval &= ~STR;
+	ap->tval &= ~(STR|CONV);
 	ap->tval |= ARR;
 	ap->sval = (char *) makesymtab(NSYMTAB);
 
@@ -1261,8 +1477,8 @@ Cell *split(Node **a, int nnn)	/* split(a[0], a[1], a[2]); a[3] is type */
 				sprintf(num, "%d", n);
 				temp = *patbeg;
 				*patbeg = '\0';
-				if (is_number(s))
-					setsymtab(num, s, atof(s), STR|NUM, (Array *) ap->sval);
+				if (is_valid_number(s, &f))
+					setsymtab(num, s, f, STR|NUM, (Array *) ap->sval);
 				else
 					setsymtab(num, s, 0.0, STR, (Array *) ap->sval);
 				*patbeg = temp;
@@ -1280,8 +1496,8 @@ Cell *split(Node **a, int nnn)	/* split(a[0], a[1], a[2]); a[3] is type */
 		}
 		n++;
 		sprintf(num, "%d", n);
-		if (is_number(s))
-			setsymtab(num, s, atof(s), STR|NUM, (Array *) ap->sval);
+		if (is_valid_number(s, &f))
+			setsymtab(num, s, f, STR|NUM, (Array *) ap->sval);
 		else
 			setsymtab(num, s, 0.0, STR, (Array *) ap->sval);
   spdone:
@@ -1300,8 +1516,8 @@ Cell *split(Node **a, int nnn)	/* split(a[0], a[1], a[2]); a[3] is type */
 			temp = *s;
 			*s = '\0';
 			sprintf(num, "%d", n);
-			if (is_number(t))
-				setsymtab(num, t, atof(t), STR|NUM, (Array *) ap->sval);
+			if (is_valid_number(t, &f))
+				setsymtab(num, t, f, STR|NUM, (Array *) ap->sval);
 			else
 				setsymtab(num, t, 0.0, STR, (Array *) ap->sval);
 			*s = temp;
@@ -1329,8 +1545,8 @@ Cell *split(Node **a, int nnn)	/* split(a[0], a[1], a[2]); a[3] is type */
 			temp = *s;
 			*s = '\0';
 			sprintf(num, "%d", n);
-			if (is_number(t))
-				setsymtab(num, t, atof(t), STR|NUM, (Array *) ap->sval);
+			if (is_valid_number(t, &f))
+				setsymtab(num, t, f, STR|NUM, (Array *) ap->sval);
 			else
 				setsymtab(num, t, 0.0, STR, (Array *) ap->sval);
 			*s = temp;
@@ -1396,6 +1612,7 @@ Cell *whilestat(Node **a, int n)	/* while (a[0]) a[1] */
 		if (isnext(x) || isexit(x) || isret(x))
 			return(x);
 		tempfree(x);
+		loopcheck();
 	}
 }
 
@@ -1414,6 +1631,7 @@ Cell *dostat(Node **a, int n)	/* do a[0]; while(a[1]) */
 		if (!istrue(x))
 			return(x);
 		tempfree(x);
+		loopcheck();
 	}
 }
 
@@ -1437,14 +1655,18 @@ Cell *forstat(Node **a, int n)	/* for (a[0]; a[1]; a[2]) a[3] */
 		tempfree(x);
 		x = execute(a[2]);
 		tempfree(x);
+		loopcheck();
 	}
 }
 
 Cell *instat(Node **a, int n)	/* for (a[0] in a[1]) a[2] */
 {
-	Cell *x, *vp, *arrayp, *cp, *ncp;
+	Cell *x, *vp, *arrayp, *cp;
 	Array *tp;
-	int i;
+	Asort *as = NULL;
+	int i, ne, oicur, walk = 0;
+	long long off, end, oocur;
+	char nbuf[NUMBUFSZ], *k, *how;
 
 	vp = execute(a[0]);
 	arrayp = execute(a[1]);
@@ -1453,23 +1675,81 @@ Cell *instat(Node **a, int n)	/* for (a[0] in a[1]) a[2] */
 	}
 	tp = (Array *) arrayp->sval;
 	tempfree(arrayp);
-	for (i = 0; i < tp->size; i++) {	/* this routine knows too much */
-		for (cp = tp->tab[i]; cp != NULL; cp = ncp) {
-			setsval(vp, cp->nval);
-			ncp = cp->cnext;
+	tp->iter++;
+	oicur = tp->icur;	/* an outer loop over tp may have set these */
+	oocur = tp->ocur;
+	tp->ocur = -1;
+	if ((how = sortedin()) != NULL) {	/* PROCINFO["sorted_in"] */
+		as = sortarray(tp, how, 0);
+		for (i = 0; i < as->n; i++) {
+			setsval(vp, as->item[i].k);
 			x = execute(a[2]);
-			if (isbreak(x)) {
-				tempfree(vp);
-				return True;
-			}
-			if (isnext(x) || isexit(x) || isret(x)) {
-				tempfree(vp);
-				return(x);
-			}
+			if (isbreak(x) || isnext(x) || isexit(x) || isret(x))
+				goto out;
 			tempfree(x);
+			loopcheck();
 		}
+		x = True;
+		goto out;
 	}
-	return True;
+	x = True;
+	ne = tp->nused;	/* elements added by the body are not visited */
+	tp->iwalk++;	/* keeps elem from being squeezed under us */
+	walk = 1;
+	for (i = tp->sfrom; i < ne; i++) {	/* this routine knows too much */
+		if ((cp = tp->elem[i]) == NULL)
+			continue;
+		if (cp->nval == NULL)	/* dense: key is its place */
+			itos(nbuf, (long long) tp->lo + i);
+		else if (tp->map && mapped(tp, cp->nval))
+			continue;	/* comes with the file's keys below */
+		setsval(vp, cp->nval ? cp->nval : nbuf);
+		tp->icur = i + 1;	/* -M may spill only what's ahead */
+		x = execute(a[2]);
+		if (isbreak(x) || isnext(x) || isexit(x) || isret(x))
+			goto out;
+		tempfree(x);
+		loopcheck();
+	}
+	tp->icur = 0;
+	tp->iwalk--;
+	walk = 0;
+	end = spillend(tp);	/* then the elements spilled under -M */
+	for (off = 0; tp->spill != NULL && off < end; ) {
+		if ((k = spillnext(tp, &off)) == NULL)
+			continue;
+		tp->ocur = off;
+		setsval(vp, k);
+		x = execute(a[2]);
+		if (isbreak(x) || isnext(x) || isexit(x) || isret(x))
+			goto out;
+		tempfree(x);
+		loopcheck();
+	}
+	for (off = 0; (k = mapnext(tp, &off)) != NULL; ) {	/* and attached */
+		setsval(vp, k);
+		x = execute(a[2]);
+		if (isbreak(x) || isnext(x) || isexit(x) || isret(x))
+			goto out;
+		tempfree(x);
+	}
+	x = True;
+  out:
+	if (as != NULL)
+		freesort(as);
+	tp->iter--;
+	tp->iwalk -= walk;
+	unshadow(tp);
+	tp->icur = oicur;
+	tp->ocur = oocur;
+	if (isbreak(x)) {
+		tempfree(vp);
+		return True;
+	}
+	if (x != True) {
+		tempfree(vp);
+	}
+	return(x);
 }
 
 Cell *bltin(Node **a, int n)	/* builtin functions. a[0] is type, a[1] is arg list */
@@ -1489,7 +1769,8 @@ Cell *bltin(Node **a, int n)	/* builtin functions. a[0] is type, a[1] is arg lis
 	switch (t) {
 	case FLENGTH:
 		if (isarr(x))
-			u = ((Array *) x->sval)->nelem;	/* GROT.  should be function*/
+			u = ((Array *) x->sval)->nelem + ((Array *) x->sval)->nspill
+				+ ((Array *) x->sval)->nmap;	/* GROT */
 		else
 			u = strlen(getsval(x));
 		break;
@@ -1536,21 +1817,18 @@ Cell *bltin(Node **a, int n)	/* builtin functions. a[0] is type, a[1] is arg lis
 		break;
 	case FTOUPPER:
 	case FTOLOWER:
-		buf = tostring(getsval(x));
+		y = gettemp();
+		p = getsval(x);
+		buf = tempsval(y, strlen(p));
 		if (t == FTOUPPER) {
-			for (p = buf; *p; p++)
-				if (islower((uschar) *p))
-					*p = toupper((uschar)*p);
+			for ( ; *p; p++)
+				*buf++ = islower((uschar) *p) ? toupper((uschar)*p) : *p;
 		} else {
-			for (p = buf; *p; p++)
-				if (isupper((uschar) *p))
-					*p = tolower((uschar)*p);
+			for ( ; *p; p++)
+				*buf++ = isupper((uschar) *p) ? tolower((uschar)*p) : *p;
 		}
 		tempfree(x);
-		x = gettemp();
-		setsval(x, buf);
-		free(buf);
-		return x;
+		return y;
 	case FFLUSH:
 		if (isrec(x) || strlen(getsval(x)) == 0) {
 			flush_all();	/* fflush() or fflush("") -> all */
@@ -1584,6 +1862,7 @@ Cell *printstat(Node **a, int n)	/* print a[0] */
 	Node *x;
 	Cell *y;
 	FILE *fp;
+	char nbuf[NUMBUFSZ];
 
 	if (a[1] == 0)	/* a[1] is redirection operator, a[2] is file */
 		fp = stdout;
@@ -1591,7 +1870,10 @@ Cell *printstat(Node **a, int n)	/* print a[0] */
 		fp = redirect(ptoi(a[1]), a[2]);
 	for (x = a[0]; x != NULL; x = x->nnext) {
 		y = execute(x);
-		fputs(getpssval(y), fp);
+		if ((y->tval & (NUM|STR)) == NUM)	/* format without caching */
+			fputs(fmtnum(nbuf, y->fval, *OFMT), fp);
+		else
+			fputs(getpssval(y), fp);
 		tempfree(y);
 		if (x->nnext == NULL)
 			fputs(*ORS, fp);
@@ -1687,9 +1969,11 @@ FILE *openfile(int a, const char *us)
 	fflush(stdout);	/* force a semblance of order */
 	m = a;
 	if (a == GT) {
-		fp = fopen(s, "w");
+		if ((fp = bio_sortopen(s, 0)) == NULL)
+			fp = fopen(s, "w");
 	} else if (a == APPEND) {
-		fp = fopen(s, "a");
+		if ((fp = bio_sortopen(s, 1)) == NULL)
+			fp = fopen(s, "a");
 		m = GT;	/* so can mix > and >> */
 	} else if (a == '|') {	/* output pipe */
 		fp = popen(s, "w");
@@ -1750,9 +2034,14 @@ Cell *closefile(Node **a, int n)
 
 void closeall(void)
 {
-	int i, stat;
+	int i, k, stat;
 
-	for (i = 0; i < FOPEN_MAX; i++) {
+	fflush(stdout);	/* before what pipes and sinks put out on closing */
+	fflush(stderr);
+	for (k = 0; k <= nfiles; k++) {
+		if (k == 2)	/* /dev/stderr last: closing a sink may complain */
+			continue;
+		i = k < nfiles ? k : 2;
 		if (files[i].fp) {
 			if (ferror(files[i].fp))
 				WARNING( "i/o error occurred on %s", files[i].fname );
@@ -1777,16 +2066,86 @@ void flush_all(void)
 
 void backsub(char **pb_ptr, char **sptr_ptr);
 
+/*
+ * sub and gsub build their result in one buffer that doubles as it
+ * fills, and hand it to the target when done instead of copying it.
+ * the replacement is taken apart once per call, not once per match:
+ * rtext holds its text with the \ and & business done, and rseg the
+ * lengths of the pieces, -1 standing for the matched text.
+ */
+
+static char	*rtext;
+static int	rtsize;
+static int	*rseg;
+static int	nrseg, rssize;
+
+static void mkrepl(char *s)	/* take replacement string s apart */
+{
+	char *pb, *beg;
+	int n;
+
+	n = strlen(s) + 1;
+	adjbuf(&rtext, &rtsize, n, recsize, 0, "sub");
+	if (2 * n > rssize) {
+		rssize = 2 * n;
+		if ((rseg = (int *) realloc(rseg, rssize * sizeof(int))) == NULL)
+			FATAL("out of memory in sub");
+	}
+	nrseg = 0;
+	pb = beg = rtext;
+	while (*s != 0) {
+		if (*s == '\\') {
+			backsub(&pb, &s);
+		} else if (*s == '&') {
+			s++;
+			rseg[nrseg++] = pb - beg;
+			rseg[nrseg++] = -1;
+			beg = pb;
+		} else
+			*pb++ = *s++;
+	}
+	rseg[nrseg++] = pb - beg;
+}
+
+static char *room(char **buf, int *bufsz, char *pb, int n, const char *what)
+{	/* make room for n more chars and a \0 at pb */
+	int len = pb - *buf + n + 1;
+
+	if (len > *bufsz)
+		adjbuf(buf, bufsz, len > 2 * *bufsz ? len : 2 * *bufsz, recsize, &pb, what);
+	return pb;
+}
+
+static char *addtext(char **buf, int *bufsz, char *pb, const char *s, int n, const char *what)
+{
+	pb = room(buf, bufsz, pb, n, what);
+	memcpy(pb, s, n);
+	return pb + n;
+}
+
+static char *addrepl(char **buf, int *bufsz, char *pb, const char *m, int mlen, const char *what)
+{	/* the replacement, for a match of mlen at m */
+	const char *r = rtext;
+	int i;
+
+	for (i = 0; i < nrseg; i++)
+		if (rseg[i] < 0)
+			pb = addtext(buf, bufsz, pb, m, mlen, what);
+		else {
+			pb = addtext(buf, bufsz, pb, r, rseg[i], what);
+			r += rseg[i];
+		}
+	return pb;
+}
+
 Cell *sub(Node **a, int nnn)	/* substitute command */
 {
-	char *sptr, *pb, *q;
+	char *sptr, *pb;
 	Cell *x, *y, *result;
 	char *t, *buf;
 	fa *pfa;
 	int bufsz = recsize;
 
-	if ((buf = (char *) malloc(bufsz)) == NULL)
-		FATAL("out of memory in sub");
 	x = execute(a[3]);	/* target string */
 	t = getsval(x);
 	if (a[0] == 0)		/* 0 => a[1] is already-compiled regexpr */
@@ -1799,55 +2158,32 @@ Cell *sub(Node **a, int nnn)	/* substitute command */
 	y = execute(a[2]);	/* replacement string */
 	result = False;
 	if (pmatch(pfa, t)) {
-		sptr = t;
-		adjbuf(&buf, &bufsz, 1+patbeg-sptr, recsize, 0, "sub");
-		pb = buf;
-		while (sptr < patbeg)
-			*pb++ = *sptr++;
-		sptr = getsval(y);
-		while (*sptr != 0) {
-			adjbuf(&buf, &bufsz, 5+pb-buf, recsize, &pb, "sub");
-			if (*sptr == '\\') {
-				backsub(&pb, &sptr);
-			} else if (*sptr == '&') {
-				sptr++;
-				adjbuf(&buf, &bufsz, 1+patlen+pb-buf, recsize, &pb, "sub");
-				for (q = patbeg; q < patbeg+patlen; )
-					*pb++ = *q++;
-			} else
-				*pb++ = *sptr++;
-		}
-		*pb = '\0';
-		if (pb > buf + bufsz)
-			FATAL("sub result1 %.30s too big; can't happen", buf);
+		if ((buf = (char *) malloc(bufsz)) == NULL)
+			FATAL("out of memory in sub");
+		mkrepl(getsval(y));
+		pb = addtext(&buf, &bufsz, buf, t, patbeg - t, "sub");
+		pb = addrepl(&buf, &bufsz, pb, patbeg, patlen, "sub");
 		sptr = patbeg + patlen;
-		if ((patlen == 0 && *patbeg) || (patlen && *(sptr-1))) {
-			adjbuf(&buf, &bufsz, 1+strlen(sptr)+pb-buf, 0, &pb, "sub");
-			while ((*pb++ = *sptr++) != 0)
-				;
-		}
-		if (pb > buf + bufsz)
-			FATAL("sub result2 %.30s too big; can't happen", buf);
-		setsval(x, buf);	/* BUG: should be able to avoid copy */
-		result = True;;
+		if ((patlen == 0 && *patbeg) || (patlen && *(sptr-1)))
+			pb = addtext(&buf, &bufsz, pb, sptr, strlen(sptr), "sub");
+		*pb = '\0';
+		adoptsval(x, buf);
+		result = True;
 	}
 	tempfree(x);
 	tempfree(y);
-	free(buf);
 	return result;
 }
 
 Cell *gsub(Node **a, int nnn)	/* global substitute */
 {
 	Cell *x, *y;
-	char *rptr, *sptr, *t, *pb, *q;
+	char *t, *pb, *q;
 	char *buf;
 	fa *pfa;
 	int mflag, tempstat, num;
 	int bufsz = recsize;
 
-	if ((buf = (char *) malloc(bufsz)) == NULL)
-		FATAL("out of memory in gsub");
 	mflag = 0;	/* if mflag == 0, can replace empty string */
 	num = 0;
 	x = execute(a[3]);	/* target string */
@@ -1860,73 +2196,52 @@ Cell *gsub(Node **a, int nnn)	/* global substitute */
 		tempfree(y);
 	}
 	y = execute(a[2]);	/* replacement string */
-	if (pmatch(pfa, t)) {
+	if (pfa->litkind == LEXACT) {	/* a plain string: no dfa at all */
+		pb = buf = NULL;
+		for ( ; (q = strstr(t, (char *) pfa->lit)) != NULL; t = q + pfa->nlit) {
+			if (num++ == 0) {
+				if ((pb = buf = (char *) malloc(bufsz)) == NULL)
+					FATAL("out of memory in gsub");
+				mkrepl(getsval(y));
+			}
+			pb = addtext(&buf, &bufsz, pb, t, q - t, "gsub");
+			pb = addrepl(&buf, &bufsz, pb, q, pfa->nlit, "gsub");
+		}
+		if (num > 0) {
+			pb = addtext(&buf, &bufsz, pb, t, strlen(t), "gsub");
+			*pb = '\0';
+			adoptsval(x, buf);
+		}
+	} else if (pmatch(pfa, t)) {
 		tempstat = pfa->initstat;
 		pfa->initstat = 2;
-		pb = buf;
-		rptr = getsval(y);
+		if ((pb = buf = (char *) malloc(bufsz)) == NULL)
+			FATAL("out of memory in gsub");
+		mkrepl(getsval(y));
 		do {
 			if (patlen == 0 && *patbeg != 0) {	/* matched empty string */
 				if (mflag == 0) {	/* can replace empty */
 					num++;
-					sptr = rptr;
-					while (*sptr != 0) {
-						adjbuf(&buf, &bufsz, 5+pb-buf, recsize, &pb, "gsub");
-						if (*sptr == '\\') {
-							backsub(&pb, &sptr);
-						} else if (*sptr == '&') {
-							sptr++;
-							adjbuf(&buf, &bufsz, 1+patlen+pb-buf, recsize, &pb, "gsub");
-							for (q = patbeg; q < patbeg+patlen; )
-								*pb++ = *q++;
-						} else
-							*pb++ = *sptr++;
-					}
+					pb = addrepl(&buf, &bufsz, pb, patbeg, patlen, "gsub");
 				}
 				if (*t == 0)	/* at end */
 					goto done;
-				adjbuf(&buf, &bufsz, 2+pb-buf, recsize, &pb, "gsub");
-				*pb++ = *t++;
-				if (pb > buf + bufsz)	/* BUG: not sure of this test */
-					FATAL("gsub result0 %.30s too big; can't happen", buf);
+				pb = addtext(&buf, &bufsz, pb, t++, 1, "gsub");
 				mflag = 0;
 			}
 			else {	/* matched nonempty string */
 				num++;
-				sptr = t;
-				adjbuf(&buf, &bufsz, 1+(patbeg-sptr)+pb-buf, recsize, &pb, "gsub");
-				while (sptr < patbeg)
-					*pb++ = *sptr++;
-				sptr = rptr;
-				while (*sptr != 0) {
-					adjbuf(&buf, &bufsz, 5+pb-buf, recsize, &pb, "gsub");
-					if (*sptr == '\\') {
-						backsub(&pb, &sptr);
-					} else if (*sptr == '&') {
-						sptr++;
-						adjbuf(&buf, &bufsz, 1+patlen+pb-buf, recsize, &pb, "gsub");
-						for (q = patbeg; q < patbeg+patlen; )
-							*pb++ = *q++;
-					} else
-						*pb++ = *sptr++;
-				}
+				pb = addtext(&buf, &bufsz, pb, t, patbeg - t, "gsub");
+				pb = addrepl(&buf, &bufsz, pb, patbeg, patlen, "gsub");
 				t = patbeg + patlen;
 				if (patlen == 0 || *t == 0 || *(t-1) == 0)
 					goto done;
-				if (pb > buf + bufsz)
-					FATAL("gsub result1 %.30s too big; can't happen", buf);
 				mflag = 1;
 			}
 		} while (pmatch(pfa,t));
-		sptr = t;
-		adjbuf(&buf, &bufsz, 1+strlen(sptr)+pb-buf, 0, &pb, "gsub");
-		while ((*pb++ = *sptr++) != 0)
-			;
-	done:	if (pb < buf + bufsz)
-			*pb = '\0';
-		else if (*(pb-1) != '\0')
-			FATAL("gsub result2 %.30s truncated; can't happen", buf);
-		setsval(x, buf);	/* BUG: should be able to avoid copy + free */
+		pb = addtext(&buf, &bufsz, pb, t, strlen(t), "gsub");
+	done:	*pb = '\0';
+		adoptsval(x, buf);
 		pfa->initstat = tempstat;
 	}
 	tempfree(x);
@@ -1934,7 +2249,6 @@ Cell *gsub(Node **a, int nnn)	/* global substitute */
 	x = gettemp();
 	x->tval = NUM;
 	x->fval = num;
-	free(buf);
 	return(x);
 }
 
@@ -0,0 +1,62 @@
+# arrays (tran.c)
+cd $TMP
+# delete by an element's own value, in an attached array: the key is
+# still needed after the element is gone
+$AWK 'BEGIN {
+	x = sprintf("%0300d", 0)
+	for (i = 0; i < 100; i++)
+		a[x i] = x i
+	dump(a, "dump")
+	attach("dump", b)
+	for (i = 0; i < 100; i += 2)
+		delete b[b[x i]]
+	print length(b), ((x 4) in b), ((x 5) in b)
+}' > out || exit 1
+echo '50 0 1' | cmp -s - out || exit 1
+# -M: 600k keys (about 70M without it) go to a spill file under a 32M cap
+# and give the same answers; the peak is checked only if run.sh set RSS
+$AWK 'BEGIN { for (i = 0; i < 600000; i++) printf("read%07d:ACGTACGTACGTACGT\t%d\n", i, i % 7) }' > in
+echo 'function spilled(  l, y) {	# is an unlinked file open, as the log is?
+	y = system("test -d /proc/self/fd") != 0	# nowhere to look
+	while (("ls -l /proc/$PPID/fd 2>/dev/null" | getline l) > 0)
+		if (l ~ /\(deleted\)$/)
+			y = 1
+	return y
+}
+function hwm(  l, f, v) {	# peak RSS, in kB
+	while ((getline l < "/proc/self/status") > 0)
+		if (split(l, f) == 3 && f[1] == "VmHWM:")
+			v = f[2]
+	return v + 0
+}' > lib.awk
+echo '{ c[$1] += $2 }
+END {
+	for (k in c) {
+		n++
+		s += c[k]
+	}
+	print n, s, c["read0000005:ACGTACGTACGTACGT"], spilled(), hwm()
+}' > prog.awk
+$AWK -M 32M -f lib.awk -f prog.awk in > out || exit 1
+$AWK -v rss="$RSS" '{ exit !($1 == 600000 && $2 == 1799995 && $3 == 5 && $4 == 1 && (!rss || $5 < 32768)) }' out || exit 1
+echo 'BEGIN {
+	n = loadtab("in", a, 1, 2)
+	print n, length(a), a["read0000005:ACGTACGTACGTACGT"], spilled(), hwm()
+}' > prog.awk
+$AWK -M 32M -f lib.awk -f prog.awk > out || exit 1
+$AWK -v rss="$RSS" '{ exit !($1 == 600000 && $2 == 600000 && $3 == 5 && $4 == 1 && (!rss || $5 < 32768)) }' out || exit 1
+# attaching over a string frees the string (3000 x 100k would be 300M)
+test -n "$RSS" || exit 0
+$AWK 'function g(b) {
+	b = sprintf("%0100000d", 0)
+	attach("dump", b)
+	return length(b)
+}
+BEGIN {
+	for (i = 0; i < 3000; i++)
+		n += g()
+	while ((getline l < "/proc/self/status") > 0)
+		if (split(l, f) == 3 && f[1] == "VmHWM:")	# peak RSS, in kB
+			print n, (f[2] < 100000 ? "small" : "big")
+}' > out || exit 1
+echo '300000 small' | cmp -s - out
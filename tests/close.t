@@ -0,0 +1,4 @@
+# closeall(): stdout is flushed before output pipes are closed
+cd $TMP
+$AWK 'BEGIN { print "b" | "sort"; print "a" | "sort"; print "plain" }' | cat > out
+printf 'plain\na\nb\n' | cmp -s - out
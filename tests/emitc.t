@@ -0,0 +1,20 @@
+# --emit-c: a program built against libbioawk.a prints what bioawk does
+cd $TMP
+dir=`dirname $AWK`
+(cd $dir && make libbioawk.a) > /dev/null 2>&1 || exit 1
+$AWK 'BEGIN { srand(5); for (i = 0; i < 2000; i++) printf("r%d\t%d\t%.3f\t%s\n", i, int(rand()*100), rand(), rand() < 0.5 ? "ACGT" : "TTGA") }' > in
+echo 'function f(x, y) { return x * y + 1 }
+BEGIN { OFS = ":" }
+$2 > 50 && $4 ~ /^AC/ { n++; s += $3 }
+{ c[$2 % 7] += f($2, $3); t = t < $2 ? $2 : t; x = $2 ^ 2 - $2 % 3 }
+NR % 500 == 0 { print NR, $1, x, length($0), substr($4, 2, 2), k }
+END {
+	for (i = 0; i < 7; i++)
+		print i, sprintf("%.4f", c[i])
+	print n, s, t
+}' > prog.awk
+$AWK --emit-c prog.awk > prog.c || exit 1
+${CC:-cc} $CFLAGS -I$dir -o prog prog.c $dir/libbioawk.a -lm -lz -lpthread || exit 1
+$AWK -v k=3 -f prog.awk in > out1 || exit 1
+./prog -v k=3 in > out2 || exit 1
+cmp -s out1 out2
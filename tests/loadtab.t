@@ -0,0 +1,23 @@
+# loadtab(): blank lines and lines without the key column are skipped
+# under the default FS and a one-character FS alike
+cd $TMP
+printf 'a 1\n\nb 2\nc\n\n' > ws
+$AWK 'BEGIN {
+	n = loadtab("ws", t, 1, 2)
+	print n, length(t), ("" in t), t["a"] + t["b"], "[" t["c"] "]"
+	n = loadtab("ws", w, 0)
+	print n, length(w), ("" in w)
+}' > out || exit 1
+printf '3 3 0 3 []\n3 3 0\n' | cmp -s - out || exit 1
+printf 'a,1\n\nb,2\n,3\nc\n' > csv
+$AWK -F, 'BEGIN {
+	n = loadtab("csv", t, 1, 2)
+	print n, length(t), ("" in t), t[""], t["a"] + t["b"]
+	n = loadtab("csv", t2, 3)
+	print n, length(t2)
+	n = loadtab("csv", w, 0)
+	print n, length(w), ("" in w)
+}' > out || exit 1
+printf '4 4 1 3 3\n0 0\n4 4 0\n' | cmp -s - out || exit 1
+$AWK 'BEGIN { print loadtab("nosuch", t, 1) }' > out || exit 1
+echo -1 | cmp -s - out
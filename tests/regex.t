@@ -0,0 +1,18 @@
+# regular expressions (b.c): ^ still anchors once the dfa outgrows its
+# space and the bit-parallel engine takes over
+cd $TMP
+$AWK 'BEGIN {
+	srand(7)
+	re = "^G|[AC]*A....................T"
+	for (i = 0; i < 10; i++) {
+		s = ""
+		for (j = 0; j < 3000; j++)
+			s = s (rand() < 0.5 ? "A" : "C")
+		t = s
+		sub(re, "x", t)
+	}
+	t = "GTTT"
+	u = "GGG"
+	print match("GTTT", re), RSTART, RLENGTH, sub(re, "x", t), t, gsub(re, "y", u), u
+}' > out || exit 1
+echo '1 1 1 1 xTTT 1 yGG' | cmp -s - out
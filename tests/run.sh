@@ -0,0 +1,22 @@
+#!/bin/sh
+# regression tests: sh tests/run.sh [awk]; each tests/*.t exits non-zero on failure
+AWK=${1:-./bioawk}
+case $AWK in /*) ;; *) AWK=`pwd`/$AWK ;; esac
+export AWK
+RSS=	# set if peak RSS can be checked: /proc has it and the build isn't instrumented
+test -r /proc/self/status && ! grep -q __asan_init $AWK 2>/dev/null && RSS=1
+export RSS
+TMP=${TMPDIR:-/tmp}/bioawk-test.$$
+export TMP
+nfail=0
+for t in `dirname $0`/*.t; do
+	mkdir -p $TMP
+	if sh $t; then
+		echo "ok	$t"
+	else
+		echo "FAIL	$t"
+		nfail=`expr $nfail + 1`
+	fi
+	rm -rf $TMP
+done
+exit $nfail
@@ -0,0 +1,10 @@
+# sorted(): more runs than may be open at once; unwritable output found early,
+# without creating the file
+cd $TMP
+$AWK 'BEGIN { srand(1); for (i = 0; i < 100000; i++) printf "c%d\t%d\tr%d\n", int(rand()*20), int(rand()*1e8), i }' > in
+(ulimit -n 32; $AWK -t '{ print > sorted("out", "1,2n", "64k") }' in) || exit 1
+LC_ALL=C sort -t '	' -k1,1 -k2,2n -k3,3 in | cmp -s - out || exit 1
+$AWK '{ print > sorted("nodir/out", "1") }' in 2> err && exit 1
+grep -q 'input record number 1,' err || exit 1
+$AWK 'BEGIN { sorted("none", "1") }' || exit 1
+test ! -f none
@@ -0,0 +1,31 @@
+# compiled expressions (vm.c): big enough that the code is grown while compiling
+cd $TMP
+echo 1 > in
+$AWK '{ s = s-- ^ 0.5; y = (!-1 || n) == ("" % (s && s == 1) == 0 ? 1 : 1) }' in > out 2>&1
+grep -q 'division by zero in mod' out || exit 1
+$AWK 'BEGIN {
+	printf "{ x = $1"
+	for (i = 0; i < 40; i++)
+		printf " && (a%d || $1 > %d)", i, i
+	print "; print x, $1 + 1 }"
+}' /dev/null > prog.awk
+printf '5\n50\n' > in
+$AWK -f prog.awk in > out || exit 1
+printf '0 6\n1 51\n' | cmp -s - out || exit 1
+# a number compared with a string: the number's temp Cell is freed
+test -n "$RSS" || exit 0
+$AWK 'function hwm(  l, f, v) {
+	while ((getline l < "/proc/self/status") > 0)
+		if (split(l, f) == 3 && f[1] == "VmHWM:")	# peak RSS, in kB
+			v = f[2]
+	close("/proc/self/status")
+	return v
+}
+BEGIN {
+	m = hwm()
+	for (i = 0; i < 1000000; i++)
+		if ((i + 1) < "a")
+			n++
+	print n, (hwm() - m < 16384 ? "small" : "big")
+}' > out || exit 1
+echo '1000000 small' | cmp -s - out
@@ -27,12 +27,181 @@ THIS SOFTWARE.
 #include <math.h>
 #include <ctype.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "awk.h"
 #include "ytab.h"
 
-#define	FULLTAB	2	/* rehash when table gets this x full */
-#define	GROWTAB 4	/* grow table by this factor */
+/*
+ * an Array keeps its elements in elem, in the order they arrived, and
+ * finds them through slot, an open-addressed table with linear probing
+ * that holds 32 bits of each key's hash and its index in elem.  slot is
+ * kept at most half full, counting deleted entries.  when it fills, a
+ * new table replaces it, and the old one (oslot) is moved across a few
+ * entries per insertion so no one access pays for the whole table.
+ * a deleted element leaves a hole in elem, so a for-in loop can index
+ * elem safely whatever its body does; holes are squeezed out when elem
+ * has to grow, unless a loop is walking it (iwalk).
+ *
+ * an array starts out dense, with no index at all: while every key is
+ * a small integer written the canonical way ("0", "17", not "017" or
+ * "1.0") and the keys are not too sparse, elem[k-lo] is the element
+ * with key k, and its nval is NULL; instat makes the key up when it
+ * needs it.  the first key that doesn't fit turns the array into an
+ * indexed one for good (undense), keeping elem and its holes as is.
+ *
+ * the elements themselves are carved out of pages that belong to the
+ * array, each Cell followed by its key when the key is short, so an
+ * element usually costs no malloc and freesymtab frees a few pages.
+ * an element's Cell is cut short (celem) before cnext and nbuf, which
+ * only temporaries, fields and plain variables need, so its strings are
+ * always malloc'ed; the variables in symtab get whole Cells.  a deleted
+ * element goes on a free list for its size (efree, linked through nval,
+ * marked CFREE) for the next key of that size to reuse.
+ *
+ * with -M, arrays are kept to a memory budget.  at a safe point
+ * (arraycheck: between records, and between turns of a loop that is
+ * not inside a function, when no one can be holding an element) the
+ * biggest arrays move their oldest elements to a log file, keeping in
+ * memory only a table of hash and log offset for each (Spill, cut into
+ * NLPART tables so that growing one is cheap).  then shrink gives back
+ * what they took: the live elements are copied to fresh pages and the
+ * old ones freed (repack), and elem and slot are cut down.  arraylive
+ * counts what arrays really take, and arraycheck leaves room for the
+ * tables that are about to grow (growsoon), since that happens between
+ * safe points.  loadtab spills as it goes (arrayfilling).  a spilled
+ * element comes back when it is looked up; for (k in a) reads the log
+ * after the elements still in memory.  an element that comes back
+ * while such a loop is running keeps its table entry, marked SHADOW,
+ * so the loop still finds its key in the log; if it is unchanged when
+ * it is spilled again, the entry just loses the mark, and once the last
+ * loop over the array is done the marked entries go (unshadow).
+ *
+ * dump(a, file) writes an array as a ready-made hash table: a header,
+ * nslot Sslots giving each key's hash and record offset, and the
+ * records, laid out as in the spill log.  attach(file, a) maps such
+ * a file and makes a read from it, with nothing loaded: a key is
+ * looked up in the file's own table, and copied into memory only when
+ * the program touches a[k] (unmap), after which the copy is the one
+ * that counts.  the file is never written; what happens to its keys
+ * (moved into memory, deleted) is noted in a byte per slot.
+ *
+ * lru(a, n) caps a at n elements.  elem is then kept in order of use:
+ * find moves an element that is used (not just tested with "in") to
+ * the end, except while a loop runs over a, so the least recently
+ * used element is the first one from sfrom on, and lruevict takes it
+ * out of the index.  the Cell itself waits on tp->evict for the next
+ * safe point, where it is handed to lru's function, if any, and freed;
+ * a Cell that an expression still holds is never reused under it.
+ *
+ * asort, asorti and for (k in a) with PROCINFO["sorted_in"] set copy
+ * the elements (keys and values into a few big pool blocks) before
+ * sorting, so the loop body may change the array freely.  numbers are
+ * put in order with an lsd radix sort on their bits, made to compare
+ * as unsigned integers, skipping bytes that are the same throughout;
+ * strings with a multikey quicksort, which looks at each character
+ * about once instead of comparing common prefixes over and over.
+ */
+
+typedef struct Page {
+	struct Page *next;
+	size_t	size;		/* with this head */
+	size_t	used;		/* carved out so far, with this head */
+} Page;
+
+typedef struct Slot {
+	unsigned int hv;	/* low bits of the key's hash */
+	int	ix;		/* index in elem, or SEMPTY or SGONE */
+} Slot;
+
+#define	SEMPTY	-1	/* never used; ends a probe */
+#define	SGONE	-2	/* element deleted; probes go on past it */
+#define	MOVESTEP 8	/* oslot entries moved per insertion */
+#define	DENSEGAP 1024	/* dense arrays may be this much more than 2x sparse */
+#define	ELEMHEAD offsetof(Cell, cnext)	/* what there is of an element's Cell */
+#define	EGRAIN	8	/* element sizes are ELEMHEAD + a multiple of this */
+#define	NECLASS	32	/* size classes; class 0 has no room for a key */
+#define	PAGEMIN	1024	/* first page of an array; later ones double... */
+#define	PAGEMAX	65536	/* ...up to this */
+
+typedef struct Sslot {
+	unsigned long long hv;	/* hash of the key */
+	long long off;		/* 1 + its offset in the log, maybe | SHADOW; */
+} Sslot;			/* 0 never used, -1 deleted */
+
+typedef struct Lslot {		/* where a spilled key is in the log */
+	unsigned int hv;	/* low bits of its hash */
+	unsigned int offhi;	/* 1 + its offset in the log, maybe | SHADOW; */
+	unsigned int offlo;	/* 0 never used, -1 deleted */
+} Lslot;
+
+#define	NLPART	64	/* Spill.slot is cut into this many tables... */
+#define	LPART(hv) ((int) ((hv) >> 58))	/* ...picked by the top of the hash */
+
+typedef struct Spill {
+	int	fd;		/* the log */
+	long long end;		/* its length */
+	long long dead;		/* records below here are all dead */
+	char	*rbuf;		/* for (k in a) reads the log through this, */
+	long long rstart;	/* which holds the log from here... */
+	long long rend;		/* ...to here */
+	Lslot	*slot[NLPART];	/* open-addressed, like Slot, but */
+	int	nslot[NLPART];	/* of any size, to keep them full */
+	int	nfill[NLPART];	/* entries live or deleted */
+	int	nshadow;	/* entries marked SHADOW */
+} Spill;
+
+typedef struct Srec {		/* each element in the log is one of these, */
+	int	klen;		/* then the key and a \0, */
+	int	slen;		/* then the string value (if STR) and a \0 */
+	int	tval;		/* NUM|STR; STR only if not CONV */
+	Awkfloat fval;
+} Srec;
+
+typedef struct Ahead {		/* head of a dump file */
+	char	magic[8];	/* AMAGIC */
+	long long nslot;	/* Sslots that follow; a power of 2 */
+	long long nelem;	/* records after them */
+} Ahead;
+
+typedef struct Attach {		/* a dump file attached to an array */
+	char	*base;		/* where it's mapped */
+	size_t	len;
+	Sslot	*slot;		/* its table, in the map; off 0 is empty */
+	long long nslot;
+	unsigned char *state;	/* of each slot: 0, MMOVED or MGONE */
+} Attach;
+
+#define	AMAGIC	"bioawk\1\0"	/* same machine only: no byte swapping */
+#define	MMOVED	1	/* key has been copied into memory */
+#define	MGONE	2	/* key has been deleted */
+#define	LRUSLACK 1024	/* evicted Cells kept, with no function to call */
+#define	SHADOW	(1LL << 62)	/* spilled, but in memory again too */
+#define	SPILLMIN 64	/* first size of each Spill.slot table */
+#define	SPILLBUF 65536	/* log is written and read this much at a time */
+
+long long arraybudget = 0;	/* -M: bytes arrays may take; 0 if no limit */
+static long long arraylive = 0;	/* bytes they do take: pages, vectors, */
+				/* indexes, malloc'ed keys; values too if -M */
+static unsigned long long arraygen = 0;	/* last Array.gen handed out */
+static Array *arrays = NULL;	/* every array, if arraybudget */
+static Array *evicting = NULL;	/* arrays with evict lists */
+static Cell lrukey = { OCELL, CCON, NULL, "", 0.0, STR|DONTFREE };
+static Cell lruval = { OCELL, CCON, NULL, "", 0.0, STR|DONTFREE };
+
+static Lslot *spillfind(Array *, const char *, unsigned long long, long long);
+static void setoff(Lslot *, long long);
+static Cell *unspill(Array *, const char *, unsigned long long);
+static char *spillrecnext(Array *, long long *, Srec *);
+static long long mapfind(Attach *, const char *, unsigned long long);
+static Cell *unmap(Array *, const char *, unsigned long long);
+static void unattach(Array *);
+static void unevict(Array *);
+static void lrudrain(void);
 
 Array	*symtab;	/* main symbol table */
 
@@ -60,6 +229,9 @@ Array	*ENVtab;	/* symbol table containing ENVIRON[...] */
 Cell	*rstartloc;	/* RSTART */
 Cell	*rlengthloc;	/* RLENGTH */
 Cell	*symtabloc;	/* SYMTAB */
+Cell	*convfmtloc;	/* CONVFMT */
+Cell	*ofmtloc;	/* OFMT */
+Cell	*procinfoloc;	/* PROCINFO */
 
 Cell	*nullloc;	/* a guaranteed empty cell */
 Node	*nullnode;	/* zero&null, converted into a node for comparisons */
@@ -67,6 +239,18 @@ Cell	*literal0;
 
 extern Cell **fldtab;
 
+/* converted strings are cached in the Cell (CONV) together with the */
+/* format that produced them, as a small index into fmttab.  formats */
+/* are copied into fmttab once and never freed, so an index stays */
+/* meaningful after CONVFMT or OFMT is reassigned. */
+
+#define	NFMT	254	/* formats remembered; cfmt 255 never matches */
+
+static char	*fmttab[NFMT+1];	/* fmttab[0] unused: cfmt 0 is "any" */
+static int	nfmt	= 0;
+static const char *lastfmt;	/* fmt pointer last seen by fmtno */
+static int	lastno;
+
 void syminit(void)	/* initialize symbol table with builtin vars */
 {
 	literal0 = setsymtab("0", "0", 0.0, NUM|STR|CON|DONTFREE, symtab);
@@ -79,8 +263,10 @@ void syminit(void)	/* initialize symbol table with builtin vars */
 	RS = &setsymtab("RS", "\n", 0.0, STR|DONTFREE, symtab)->sval;
 	OFS = &setsymtab("OFS", DEFAULT_FS, 0.0, STR|DONTFREE, symtab)->sval;
 	ORS = &setsymtab("ORS", "\n", 0.0, STR|DONTFREE, symtab)->sval;
-	OFMT = &setsymtab("OFMT", "%.6g", 0.0, STR|DONTFREE, symtab)->sval;
-	CONVFMT = &setsymtab("CONVFMT", "%.6g", 0.0, STR|DONTFREE, symtab)->sval;
+	ofmtloc = setsymtab("OFMT", "%.6g", 0.0, STR|DONTFREE, symtab);
+	OFMT = &ofmtloc->sval;
+	convfmtloc = setsymtab("CONVFMT", "%.6g", 0.0, STR|DONTFREE, symtab);
+	CONVFMT = &convfmtloc->sval;
 	FILENAME = &setsymtab("FILENAME", "", 0.0, STR|DONTFREE, symtab)->sval;
 	nfloc = setsymtab("NF", "", 0.0, NUM, symtab);
 	NF = &nfloc->fval;
@@ -95,6 +281,8 @@ void syminit(void)	/* initialize symbol table with builtin vars */
 	RLENGTH = &rlengthloc->fval;
 	symtabloc = setsymtab("SYMTAB", "", 0.0, ARR, symtab);
 	symtabloc->sval = (char *) symtab;
+	procinfoloc = setsymtab("PROCINFO", "", 0.0, ARR, symtab);
+	procinfoloc->sval = (char *) makesymtab(NSYMTAB);
 }
 
 void arginit(int ac, char **av)	/* set up ARGV and ARGC */
@@ -102,6 +290,7 @@ void arginit(int ac, char **av)	/* set up ARGV and ARGC */
 	Cell *cp;
 	int i;
 	char temp[50];
+	Awkfloat f;
 
 	ARGC = &setsymtab("ARGC", "", (Awkfloat) ac, NUM, symtab)->fval;
 	cp = setsymtab("ARGV", "", 0.0, ARR, symtab);
@@ -109,8 +298,8 @@ void arginit(int ac, char **av)	/* set up ARGV and ARGC */
 	cp->sval = (char *) ARGVtab;
 	for (i = 0; i < ac; i++) {
 		sprintf(temp, "%d", i);
-		if (is_number(*av))
-			setsymtab(temp, *av, atof(*av), STR|NUM, ARGVtab);
+		if (is_valid_number(*av, &f))
+			setsymtab(temp, *av, f, STR|NUM, ARGVtab);
 		else
 			setsymtab(temp, *av, 0.0, STR, ARGVtab);
 		av++;
@@ -121,6 +310,7 @@ void envinit(char **envp)	/* set up ENVIRON variable */
 {
 	Cell *cp;
 	char *p;
+	Awkfloat f;
 
 	cp = setsymtab("ENVIRON", "", 0.0, ARR, symtab);
 	ENVtab = makesymtab(NSYMTAB);
@@ -131,33 +321,205 @@ void envinit(char **envp)	/* set up ENVIRON variable */
 		if( p == *envp ) /* no left hand side name in env string */
 			continue;
 		*p++ = 0;	/* split into two strings at = */
-		if (is_number(p))
-			setsymtab(*envp, p, atof(p), STR|NUM, ENVtab);
+		if (is_valid_number(p, &f))
+			setsymtab(*envp, p, f, STR|NUM, ENVtab);
 		else
 			setsymtab(*envp, p, 0.0, STR, ENVtab);
 		p[-1] = '=';	/* restore in case env is passed down to a shell */
 	}
 }
 
+static long long mcost(size_t n)	/* what malloc(n) takes, about */
+{
+	return n <= 24 ? 32 : (n + 23) & ~15;
+}
+
+static void svcharge(Cell *vp, int sign)	/* -M: count an element's string in or out */
+{
+	if (arraybudget > 0 && vp->celem && freeable(vp))
+		arraylive += sign * mcost(strlen(vp->sval) + 1);
+}
+
+static Slot *makeslots(int n)	/* n empty slots */
+{
+	Slot *sp;
+
+	if ((sp = (Slot *) malloc(n * sizeof(Slot))) == NULL)
+		FATAL("out of space for array index of size %d", n);
+	memset(sp, 0xff, n * sizeof(Slot));	/* all ix SEMPTY */
+	arraylive += (long long) n * sizeof(Slot);
+	return sp;
+}
+
+static void freeslots(Slot *sp, int n)
+{
+	free(sp);
+	arraylive -= (long long) n * sizeof(Slot);
+}
+
+static void setesize(Array *tp, int n)	/* make tp->elem n long */
+{
+	tp->elem = (Cell **) realloc(tp->elem, n * sizeof(Cell *));
+	if (tp->elem == NULL)
+		FATAL("out of space for array of %d elements", n);
+	arraylive += (long long) (n - tp->esize) * sizeof(Cell *);
+	tp->esize = n;
+}
+
 Array *makesymtab(int n)	/* make a new symbol table */
 {
 	Array *ap;
-	Cell **tp;
+	int ns;
 
+	for (ns = 8; ns < 2 * n; ns *= 2)
+		;
 	ap = (Array *) malloc(sizeof(Array));
-	tp = (Cell **) calloc(n, sizeof(Cell *));
-	if (ap == NULL || tp == NULL)
+	if (ap == NULL || (ap->elem = (Cell **) malloc(n * sizeof(Cell *))) == NULL)
 		FATAL("out of space in makesymtab");
 	ap->nelem = 0;
-	ap->size = n;
-	ap->tab = tp;
+	ap->nused = 0;
+	ap->esize = n;
+	arraylive += (long long) n * sizeof(Cell *);
+	ap->gen = ++arraygen;
+	ap->lo = 0;
+	ap->slot = NULL;	/* dense until shown otherwise */
+	ap->nslot = ns;
+	ap->nfill = 0;
+	ap->oslot = NULL;
+	ap->onslot = ap->omove = 0;
+	ap->iter = 0;
+	ap->iwalk = 0;
+	ap->last = NULL;
+	ap->page = NULL;
+	ap->psize = 0;
+	ap->pnext = NULL;
+	ap->pleft = 0;
+	for (ns = 0; ns < NECLASS; ns++)
+		ap->efree[ns] = NULL;
+	ap->spill = NULL;
+	ap->nspill = 0;
+	ap->map = NULL;
+	ap->nmap = 0;
+	ap->lrucap = 0;
+	ap->lrufcn = NULL;
+	ap->evict = NULL;
+	ap->evfirst = ap->nevict = ap->evsize = 0;
+	ap->enext = NULL;
+	ap->icur = 0;
+	ap->ocur = -1;
+	ap->sfrom = 0;
+	ap->anext = ap->aprev = NULL;
+	if (arraybudget > 0) {
+		if ((ap->anext = arrays) != NULL)
+			arrays->aprev = ap;
+		arrays = ap;
+	}
 	return(ap);
 }
 
+static int eclass(int keylen)	/* size class for a key of keylen bytes */
+{
+	int c = (keylen + EGRAIN) / EGRAIN;	/* room for the \0 too */
+
+	return c < NECLASS ? c : 0;
+}
+
+static char *inkey(Cell *p)	/* where p's key is kept if it's short */
+{
+	return (char *) p + (p->celem ? ELEMHEAD : sizeof(Cell));
+}
+
+static int cellsize(Cell *p)	/* bytes p takes in its page */
+{
+	int n = p->celem ? ELEMHEAD : sizeof(Cell);
+
+	if (p->csub == CFREE)	/* tval is its size class */
+		return n + p->tval * EGRAIN;
+	return n + (p->nval == inkey(p) ? eclass(strlen(p->nval)) * EGRAIN : 0);
+}
+
+static Cell *carve(Array *tp, int n)	/* n bytes for an element from tp's pages */
+{
+	Page *pg;
+	Cell *p;
+
+	if (tp->pleft < n) {	/* rest of this page goes unused */
+		if (tp->page)
+			tp->page->used = tp->page->size - tp->pleft;
+		if (tp->psize == 0)
+			tp->psize = PAGEMIN;
+		else if (tp->psize < PAGEMAX)
+			tp->psize *= 2;
+		if ((pg = (Page *) malloc(tp->psize)) == NULL)
+			FATAL("out of space for array element");
+		pg->size = tp->psize;
+		pg->used = sizeof(Page);
+		arraylive += pg->size;
+		pg->next = tp->page;
+		tp->page = pg;
+		tp->pnext = (char *) (pg + 1);
+		tp->pleft = tp->psize - sizeof(Page);
+	}
+	p = (Cell *) tp->pnext;
+	tp->pnext += n;
+	tp->pleft -= n;
+	return p;
+}
+
+static Cell *newelem(Array *tp, const char *key)	/* new element for key */
+{
+	Cell *p;
+	int c, len;
+
+	len = key ? strlen(key) : 0;
+	c = key ? eclass(len) : 0;
+	if ((p = tp->efree[c]) != NULL)
+		tp->efree[c] = (Cell *) p->nval;
+	else
+		p = carve(tp, (tp == symtab ? sizeof(Cell) : ELEMHEAD) + c * EGRAIN);
+	p->celem = tp != symtab;
+	if (c > 0) {
+		p->nval = inkey(p);
+		memcpy(p->nval, key, len + 1);
+	} else if (key != NULL) {
+		p->nval = tostring(key);
+		arraylive += mcost(len + 1);
+	} else
+		p->nval = NULL;
+	return p;
+}
+
+static void dropkey(Cell *p)	/* free p's key and value, unless in its page */
+{
+	svcharge(p, -1);
+	if (freeable(p))
+		xfree(p->sval);
+	if (p->nval != NULL && p->nval != inkey(p)) {
+		arraylive -= mcost(strlen(p->nval) + 1);
+		xfree(p->nval);
+	}
+}
+
+static void dropelem(Array *tp, Cell *p)	/* element p is done with */
+{
+	int c = 0;
+
+	if (tp->last == p)
+		tp->last = NULL;
+	if (p->nval == inkey(p))
+		c = eclass(strlen(p->nval));
+	dropkey(p);
+	p->nval = (char *) tp->efree[c];
+	p->csub = CFREE;	/* so repack can tell it from a live one */
+	p->tval = c;
+	tp->efree[c] = p;
+}
+
 void freesymtab(Cell *ap)	/* free a symbol table */
 {
-	Cell *cp, *temp;
+	Cell *cp;
 	Array *tp;
+	Page *pg;
 	int i;
 
 	if (!isarr(ap))
@@ -165,117 +527,1725 @@ void freesymtab(Cell *ap)	/* free a symbol table */
 	tp = (Array *) ap->sval;
 	if (tp == NULL)
 		return;
-	for (i = 0; i < tp->size; i++) {
-		for (cp = tp->tab[i]; cp != NULL; cp = temp) {
-			xfree(cp->nval);
-			if (freeable(cp))
-				xfree(cp->sval);
-			temp = cp->cnext;	/* avoids freeing then using */
-			free(cp); 
-			tp->nelem--;
-		}
-		tp->tab[i] = 0;
+	for (i = 0; i < tp->nused; i++) {
+		if ((cp = tp->elem[i]) == NULL)
+			continue;
+		dropkey(cp);
+		tp->elem[i] = NULL;
+		tp->nelem--;
 	}
 	if (tp->nelem != 0)
 		WARNING("can't happen: inconsistent element count freeing %s", ap->nval);
-	free(tp->tab);
+	tp->last = NULL;
+	for (i = 0; i < tp->nevict; i++)
+		dropkey(tp->evict[tp->evfirst + i]);
+	free(tp->evict);
+	tp->evict = NULL;
+	tp->evfirst = tp->nevict = tp->evsize = 0;
+	unevict(tp);
+	while ((pg = tp->page) != NULL) {
+		tp->page = pg->next;
+		arraylive -= pg->size;
+		free(pg);
+	}
+	if (tp->spill) {
+		close(tp->spill->fd);
+		free(tp->spill->rbuf);
+		for (i = 0; i < NLPART; i++) {
+			free(tp->spill->slot[i]);
+			arraylive -= (long long) tp->spill->nslot[i] * sizeof(Lslot);
+		}
+		free(tp->spill);
+		tp->spill = NULL;
+		tp->nspill = 0;
+	}
+	if (tp->map)
+		unattach(tp);
+	if (tp->anext)
+		tp->anext->aprev = tp->aprev;
+	if (tp->aprev)
+		tp->aprev->anext = tp->anext;
+	else if (arrays == tp)
+		arrays = tp->anext;
+	tp->anext = tp->aprev = NULL;
+	if (tp->iter > 0)	/* a for-in loop is still walking it; */
+		return;		/* let it find nothing, and leak tp */
+	free(tp->elem);
+	arraylive -= (long long) tp->esize * sizeof(Cell *);
+	if (tp->slot)
+		freeslots(tp->slot, tp->nslot);
+	if (tp->oslot)
+		freeslots(tp->oslot, tp->onslot);
 	free(tp);
 }
 
+static int findslot(Array *tp, Slot *sp, int ns, const char *s, unsigned long long hv)
+{		/* position of key s in slot table sp, or -1 */
+	unsigned i, m = ns - 1;
+
+	for (i = hv & m; sp[i].ix != SEMPTY; i = (i + 1) & m)
+		if (sp[i].hv == (unsigned) hv && sp[i].ix >= 0
+		    && strcmp(s, tp->elem[sp[i].ix]->nval) == 0)
+			return i;
+	return -1;
+}
+
+static Slot *slotof(Array *tp, const char *s, unsigned long long hv)
+{		/* slot of key s, in slot or oslot, or NULL */
+	int i;
+
+	if ((i = findslot(tp, tp->slot, tp->nslot, s, hv)) >= 0)
+		return &tp->slot[i];
+	if (tp->oslot && (i = findslot(tp, tp->oslot, tp->onslot, s, hv)) >= 0)
+		return &tp->oslot[i];
+	return NULL;
+}
+
+static int putslot(Slot *sp, int ns, unsigned long long hv, int ix)
+{		/* enter ix, known not to be present; 1 if it used a new slot */
+	unsigned i, m = ns - 1;
+
+	for (i = hv & m; sp[i].ix >= 0; i = (i + 1) & m)
+		;
+	sp[i].hv = hv;
+	if (sp[i].ix == SGONE) {
+		sp[i].ix = ix;
+		return 0;
+	}
+	sp[i].ix = ix;
+	return 1;
+}
+
+static void moveslots(Array *tp, int n)	/* move n entries of oslot into slot */
+{
+	Slot *op;
+
+	while (n-- > 0 && tp->omove < tp->onslot) {
+		op = &tp->oslot[tp->omove++];
+		if (op->ix >= 0) {
+			tp->nfill += putslot(tp->slot, tp->nslot, op->hv, op->ix);
+			op->ix = SGONE;
+		} else
+			n++;	/* only count real moves */
+	}
+	if (tp->omove >= tp->onslot) {
+		freeslots(tp->oslot, tp->onslot);
+		tp->oslot = NULL;
+	}
+}
+
+static void growslots(Array *tp)	/* start moving to a fresh index */
+{
+	int ns;
+
+	if (tp->oslot)		/* finish the last move first */
+		moveslots(tp, tp->onslot);
+	ns = tp->nslot;
+	if (4 * tp->nelem >= ns)	/* else it's mostly deletions */
+		ns *= 2;
+	tp->oslot = tp->slot;
+	tp->onslot = tp->nslot;
+	tp->omove = 0;
+	tp->slot = makeslots(ns);
+	tp->nslot = ns;
+	tp->nfill = 0;
+}
+
+static void squeeze(Array *tp)	/* close the holes in elem; no loop may be walking it */
+{
+	Slot *sp;
+	int *map, i, j, k, n;
+
+	if ((map = (int *) malloc(tp->nused * sizeof(int))) == NULL)
+		FATAL("out of space compacting array");
+	for (i = j = 0; i < tp->nused; i++) {
+		map[i] = j;
+		if (tp->elem[i] != NULL)
+			tp->elem[j++] = tp->elem[i];
+	}
+	tp->nused = j;
+	tp->sfrom = 0;
+	for (k = 0; k < 2; k++) {
+		sp = k == 0 ? tp->slot : tp->oslot;
+		n = k == 0 ? tp->nslot : tp->onslot;
+		for (i = 0; sp != NULL && i < n; i++)
+			if (sp[i].ix >= 0)
+				sp[i].ix = map[sp[i].ix];
+	}
+	free(map);
+}
+
+static void growelem(Array *tp)	/* make room for another element */
+{
+	if (tp->iwalk == 0 && 2 * tp->nelem < tp->nused)
+		squeeze(tp);
+	else
+		setesize(tp, 2 * tp->esize);
+}
+
+static void reslot(Array *tp, int ns)	/* rebuild the index with ns slots, all at once */
+{
+	Slot *sp;
+	int i, on;
+
+	if (tp->oslot)
+		moveslots(tp, tp->onslot);
+	sp = tp->slot;
+	on = tp->nslot;
+	tp->slot = makeslots(ns);
+	tp->nslot = ns;
+	tp->nfill = 0;
+	for (i = 0; i < on; i++)
+		if (sp[i].ix >= 0)
+			tp->nfill += putslot(tp->slot, ns, sp[i].hv, sp[i].ix);
+	freeslots(sp, on);
+}
+
+void arrayreserve(Array *tp, int n)	/* make room for n more elements */
+{
+	int ns;
+
+	if (tp->slot == NULL || n <= 0)	/* dense arrays grow their own way */
+		return;
+	for (ns = tp->nslot; ns < 2 * (tp->nelem + n); ns *= 2)
+		;
+	if (ns > tp->nslot)	/* all at once; no one's waiting */
+		reslot(tp, ns);
+	if (tp->esize < tp->nused + n)
+		setesize(tp, tp->nused + n);
+}
+
+static int intkey(const char *s, int *kp)	/* is s a dense key?  *kp = value */
+{
+	int k, n;
+
+	if (s[0] == '0' && s[1] == '\0') {
+		*kp = 0;
+		return 1;
+	}
+	for (k = n = 0; isdigit((uschar) *s) && n < 9; s++, n++) {
+		if (n == 0 && *s == '0')
+			return 0;
+		k = 10 * k + *s - '0';
+	}
+	*kp = k;
+	return n > 0 && *s == '\0';
+}
+
+static int denseix(Array *tp, int k)	/* make room for key k; its index or -1 */
+{
+	int i, need, shift;
+
+	if (tp->nused == 0)
+		tp->lo = k;
+	if (k >= tp->lo) {
+		if ((need = k - tp->lo + 1) <= tp->nused)
+			return k - tp->lo;
+		shift = 0;
+	} else {
+		if (tp->iter > 0)	/* would move elements under the loop */
+			return -1;
+		shift = tp->lo - k;
+		need = tp->nused + shift;
+	}
+	if (need > 2 * tp->nelem + DENSEGAP)
+		return -1;
+	if (need > tp->esize) {
+		for (i = tp->esize; i < need; i *= 2)
+			;
+		setesize(tp, i);
+	}
+	if (shift > 0) {
+		memmove(tp->elem + shift, tp->elem, tp->nused * sizeof(Cell *));
+		for (i = 0; i < shift; i++)
+			tp->elem[i] = NULL;
+		tp->lo = k;
+	} else
+		for (i = tp->nused; i < need; i++)
+			tp->elem[i] = NULL;
+	tp->nused = need;
+	return k - tp->lo;
+}
+
+static void undense(Array *tp)	/* give a dense array its keys and an index */
+{
+	char buf[NUMBUFSZ];
+	Cell *cp;
+	int i, ns;
+
+	for (ns = 8; ns < 2 * (tp->nelem + 1); ns *= 2)
+		;
+	tp->slot = makeslots(ns);
+	tp->nslot = ns;
+	tp->nfill = 0;
+	for (i = 0; i < tp->nused; i++) {
+		if ((cp = tp->elem[i]) == NULL)
+			continue;
+		arraylive += mcost(itos(buf, (long long) tp->lo + i) + 1);
+		cp->nval = tostring(buf);
+		tp->nfill += putslot(tp->slot, tp->nslot, hash(buf), i);
+	}
+	tp->lo = 0;
+}
+
 void freeelem(Cell *ap, const char *s)	/* free elem s from ap (i.e., ap["s"] */
 {
 	Array *tp;
-	Cell *p, *prev = NULL;
-	int h;
-	
+	Slot *sp;
+	Lslot *ls;
+	Cell *p;
+	unsigned long long hv;
+	long long j;
+	int i;
+
 	tp = (Array *) ap->sval;
-	h = hash(s, tp->size);
-	for (p = tp->tab[h]; p != NULL; prev = p, p = p->cnext)
-		if (strcmp(s, p->nval) == 0) {
-			if (prev == NULL)	/* 1st one */
-				tp->tab[h] = p->cnext;
-			else			/* middle somewhere */
-				prev->cnext = p->cnext;
-			if (freeable(p))
-				xfree(p->sval);
-			free(p->nval);
-			free(p);
-			tp->nelem--;
+	tp->gen = ++arraygen;
+	if (tp->slot == NULL) {
+		if (!intkey(s, &i) || (i -= tp->lo) < 0 || i >= tp->nused
+		    || (p = tp->elem[i]) == NULL)
 			return;
+		tp->elem[i] = NULL;
+		tp->nelem--;
+		dropelem(tp, p);
+		return;
+	}
+	hv = hash(s);
+	if ((sp = slotof(tp, s, hv)) == NULL) {
+		if (tp->spill && (ls = spillfind(tp, s, hv, 0)) != NULL) {
+			setoff(ls, -1);
+			tp->nspill--;
+		} else if (tp->map && (j = mapfind(tp->map, s, hv)) >= 0
+		    && tp->map->state[j] == 0) {
+			tp->map->state[j] = MGONE;
+			tp->nmap--;
 		}
+		return;
+	}
+	p = tp->elem[sp->ix];
+	tp->elem[sp->ix] = NULL;
+	sp->ix = SGONE;
+	tp->nelem--;
+	if (tp->spill && (ls = spillfind(tp, s, hv, SHADOW)) != NULL) {
+		setoff(ls, -1);		/* a running loop mustn't see it */
+		tp->spill->nshadow--;
+	}
+	if (tp->map && (j = mapfind(tp->map, s, hv)) >= 0)
+		tp->map->state[j] = MGONE;	/* nor the copy in the file */
+	dropelem(tp, p);	/* last: s may be p's key or value */
 }
 
-Cell *setsymtab(const char *n, const char *s, Awkfloat f, unsigned t, Array *tp)
+#define	spillable(tp)	((tp) != symtab && (tp)->slot != NULL \
+			&& (tp)->map == NULL && (tp)->lrucap == 0)	/* not dense, attached or lru */
+
+static Cell *find(Array *tp, const char *s, unsigned long long *hvp, int use)
+{		/* element with key s, or NULL; *hvp = hash of s if computed */
+	Slot *sp;	/* use: it's being used, not just tested, for lru() */
+	Cell *p;
+
+	if ((p = tp->last) != NULL && strcmp(s, p->nval) == 0)
+		return p;	/* runs of one key are common in sorted input */
+	*hvp = hash(s);
+	if ((sp = slotof(tp, s, *hvp)) == NULL)
+		return NULL;
+	p = tp->elem[sp->ix];
+	if (tp->lrucap == 0)
+		return tp->last = p;
+	if (!use)
+		return p;	/* last must be the most recently used */
+	if (tp->iter == 0 && sp->ix != tp->nused - 1) {	/* move it to the end */
+		if (tp->nused >= tp->esize)
+			growelem(tp);	/* may squeeze, changing sp->ix */
+		tp->elem[sp->ix] = NULL;
+		tp->elem[tp->nused] = p;
+		sp->ix = tp->nused++;
+	}
+	return tp->last = p;
+}
+
+static Cell *newcell(Array *, const char *, unsigned long long, int,
+	const char *, Awkfloat, unsigned);
+
+static void spillread(Spill *sp, void *buf, size_t n, long long off)
+{
+	if (pread(sp->fd, buf, n, (off_t) off) != (ssize_t) n)
+		FATAL("can't read array spill file");
+}
+
+static void spillwrite(Spill *sp, const void *buf, size_t n, long long off)
+{
+	if (pwrite(sp->fd, buf, n, (off_t) off) != (ssize_t) n)
+		FATAL("can't write array spill file");
+}
+
+static char	*spbuf;	/* last record read by spillrec */
+static size_t	spsize;
+
+static char *spillrec(Spill *sp, long long off, Srec *r)	/* key of record at off */
+{		/* its value follows the key's \0 */
+	size_t n;
+
+	spillread(sp, r, sizeof(Srec), off);
+	n = r->klen + r->slen + 2;
+	if (n > spsize) {
+		spsize = n + 64;
+		if ((spbuf = (char *) realloc(spbuf, spsize)) == NULL)
+			FATAL("out of space reading array spill file");
+	}
+	spillread(sp, spbuf, n, off + sizeof(Srec));
+	return spbuf;
+}
+
+static long long offof(Lslot *ls)	/* ls's offset field */
+{
+	return (long long) ((unsigned long long) ls->offhi << 32 | ls->offlo);
+}
+
+static void setoff(Lslot *ls, long long off)
+{
+	ls->offhi = (unsigned long long) off >> 32;
+	ls->offlo = (unsigned int) off;
+}
+
+static unsigned int lhome(unsigned int hv, int n)	/* hv's first place of n */
+{
+	return ((unsigned long long) hv * n) >> 32;
+}
+
+static Lslot *spillfind(Array *tp, const char *s, unsigned long long hv, long long shadow)
+{		/* entry for s in tp->spill, or NULL; shadow: SHADOW or 0 */
+	Spill *sp = tp->spill;
+	Lslot *st = sp->slot[LPART(hv)];
+	Srec r;
+	long long off;
+	unsigned i, n = sp->nslot[LPART(hv)];
+
+	for (i = lhome(hv, n); (off = offof(&st[i])) != 0; i = i + 1 < n ? i + 1 : 0) {
+		if (off < 0 || st[i].hv != (unsigned) hv || (off & SHADOW) != shadow)
+			continue;
+		if (strcmp(s, spillrec(sp, (off & ~SHADOW) - 1, &r)) == 0)
+			return &st[i];
+	}
+	return NULL;
+}
+
+static int lput(Lslot *st, int n, unsigned int hv, long long off)
+{		/* enter off in st; 1 if it used a new entry */
+	unsigned i;
+	int fresh;
+
+	for (i = lhome(hv, n); offof(&st[i]) > 0; i = i + 1 < n ? i + 1 : 0)
+		;
+	fresh = offof(&st[i]) == 0;
+	st[i].hv = hv;
+	setoff(&st[i], off);
+	return fresh;
+}
+
+static void spillput(Spill *sp, unsigned long long hv, long long off)
+{		/* enter an element at 1+off in the log */
+	Lslot *st, *old;
+	int i, k = LPART(hv), n, on, live;
+
+	if (8 * (sp->nfill[k] + 1) > 7 * sp->nslot[k]) {	/* rebuild, bigger if need be */
+		old = sp->slot[k];	/* only this table: 1/NLPART of the index */
+		on = sp->nslot[k];
+		for (i = live = 0; i < on; i++)
+			if (offof(&old[i]) > 0)
+				live++;
+		if ((n = (live + 1) / 2 * 3) < SPILLMIN)	/* 2/3 full */
+			n = SPILLMIN;
+		if ((st = (Lslot *) calloc(n, sizeof(Lslot))) == NULL)
+			FATAL("out of space for array spill index of size %d", n);
+		arraylive += (long long) (n - on) * sizeof(Lslot);
+		sp->slot[k] = st;
+		sp->nslot[k] = n;
+		sp->nfill[k] = 0;
+		for (i = 0; i < on; i++)
+			if (offof(&old[i]) > 0)
+				sp->nfill[k] += lput(st, n, old[i].hv, offof(&old[i]));
+		free(old);
+	}
+	sp->nfill[k] += lput(sp->slot[k], sp->nslot[k], hv, off);
+}
+
+static Cell *unspill(Array *tp, const char *s, unsigned long long hv)
+{		/* bring s back from the log, if it's there */
+	Spill *sp = tp->spill;
+	Lslot *ls;
+	Srec r;
+	char *k;
+
+	if ((ls = spillfind(tp, s, hv, 0)) == NULL)
+		return NULL;
+	k = spillrec(sp, offof(ls) - 1, &r);
+	if (tp->iter > 0) {
+		setoff(ls, offof(ls) | SHADOW);
+		sp->nshadow++;
+	} else
+		setoff(ls, -1);
+	tp->nspill--;
+	   dprintf( ("unspill %s\n", s) );
+	return newcell(tp, s, hv, -1, r.tval & STR ? k + r.klen + 1 : NULL,
+		r.fval, r.tval);
+}
+
+static Spill *newspill(void)	/* an empty log and index */
+{
+	Spill *sp;
+	FILE *fp;
+	int k;
+
+	if ((sp = (Spill *) malloc(sizeof(Spill))) == NULL)
+		FATAL("out of space for array spill index");
+	for (k = 0; k < NLPART; k++) {
+		if ((sp->slot[k] = (Lslot *) calloc(SPILLMIN, sizeof(Lslot))) == NULL)
+			FATAL("out of space for array spill index");
+		sp->nslot[k] = SPILLMIN;
+		sp->nfill[k] = 0;
+	}
+	arraylive += (long long) NLPART * SPILLMIN * sizeof(Lslot);
+	if ((fp = tmpfile()) == NULL || (sp->fd = dup(fileno(fp))) < 0)
+		FATAL("can't make a temporary file to spill arrays to");
+	fclose(fp);	/* the file lives on through fd */
+	sp->end = sp->dead = 0;
+	sp->nshadow = 0;
+	sp->rbuf = NULL;
+	sp->rstart = sp->rend = 0;
+	return sp;
+}
+
+static int samerec(Spill *sp, long long off, Srec *r, Cell *p)
+{		/* is the record at off what p would be written as? */
+	Srec o;
+	char *k;
+
+	k = spillrec(sp, off, &o);
+	return o.tval == r->tval && o.klen == r->klen && o.slen == r->slen
+	    && memcmp(&o.fval, &r->fval, sizeof(Awkfloat)) == 0
+	    && memcmp(k + o.klen + 1, r->slen ? p->sval : "", r->slen) == 0;
+}
+
+static void repack(Array *tp)	/* move tp's elements to fresh pages */
+{		/* a page at a time, freeing each old one as it empties */
+	Page *pg, *old;
+	Slot *st;
+	Cell *p, *q;
+	char *e;
+	int c, n;
+
+	if ((old = tp->page) == NULL)
+		return;
+	old->used = old->size - tp->pleft;
+	tp->page = NULL;
+	tp->psize = 0;
+	tp->pnext = NULL;
+	tp->pleft = 0;
+	for (c = 0; c < NECLASS; c++)
+		tp->efree[c] = NULL;
+	while ((pg = old) != NULL) {
+		old = pg->next;
+		for (e = (char *) (pg + 1); e < (char *) pg + pg->used; e += n) {
+			p = (Cell *) e;
+			n = cellsize(p);
+			if (p->csub == CFREE)
+				continue;
+			q = carve(tp, n);
+			memcpy(q, p, n);
+			if (p->nval == inkey(p))
+				q->nval = inkey(q);
+			if (!p->celem && p->sval == p->nbuf)
+				q->sval = q->nbuf;
+			if ((st = slotof(tp, p->nval, hash(p->nval))) == NULL)
+				FATAL("can't happen: array element %s not in index", p->nval);
+			tp->elem[st->ix] = q;
+			if (tp->last == p)
+				tp->last = q;
+		}
+		arraylive -= pg->size;
+		free(pg);
+	}
+}
+
+static void shrink(Array *tp)	/* give back what spilled elements took */
 {
-	int h;
 	Cell *p;
+	int i, j, n, ns;
 
-	if (n != NULL && (p = lookup(n, tp)) != NULL) {
-		   dprintf( ("setsymtab found %p: n=%s s=\"%s\" f=%g t=%o\n",
-			(void*)p, NN(p->nval), NN(p->sval), p->fval, p->tval) );
-		return(p);
+	repack(tp);
+	for (i = j = 0; i < tp->nused; i++)	/* squeeze, unless a loop is walking elem */
+		if ((p = tp->elem[i]) != NULL || tp->iwalk > 0)
+			tp->elem[j++] = p;
+	tp->nused = j;
+	if (tp->iwalk == 0) {
+		tp->sfrom = 0;
+		if ((n = tp->nused + tp->nused / 4 + 16) < tp->esize)
+			setesize(tp, n);
 	}
-	p = (Cell *) malloc(sizeof(Cell));
-	if (p == NULL)
-		FATAL("out of space for symbol table at %s", n);
-	p->nval = tostring(n);
-	p->sval = s ? tostring(s) : tostring("");
+	for (ns = 8; ns < 2 * (tp->nelem + tp->nelem / 8 + 16); ns *= 2)
+		;	/* not so tight that it grows again at once */
+	if (tp->oslot) {	/* the index is made again from elem, */
+		freeslots(tp->oslot, tp->onslot);	/* so the old one goes first */
+		tp->oslot = NULL;
+	}
+	freeslots(tp->slot, tp->nslot);
+	tp->slot = makeslots(ns);
+	tp->nslot = ns;
+	tp->nfill = 0;
+	for (i = 0; i < tp->nused; i++)
+		if ((p = tp->elem[i]) != NULL)
+			tp->nfill += putslot(tp->slot, ns, hash(p->nval), i);
+}
+
+static void spillarray(Array *tp, long long target, int from)
+{		/* move tp's oldest elements, from elem[from] on, to the log */
+	Spill *sp;	/* until arraylive would be down to target */
+	Slot *st;
+	Lslot *ls;
+	Cell *p;
+	Srec r;
+	char *buf, *rec;
+	unsigned long long hv;
+	long long base, len, off, freed;
+	int j, n, nsp = tp->nspill;
+
+	if ((sp = tp->spill) == NULL)
+		sp = tp->spill = newspill();
+	if ((buf = (char *) malloc(SPILLBUF)) == NULL)
+		FATAL("out of space spilling array");
+	base = sp->end;		/* buf holds the log from here on */
+	len = 0;
+	freed = 0;	/* what shrink will give back, about */
+	j = tp->iter > 0 && tp->icur > tp->sfrom ? tp->icur : tp->sfrom;
+	if (j < from)
+		j = from;
+	for ( ; j < tp->nused && arraylive - freed > target; j++) {
+		if ((p = tp->elem[j]) == NULL) {
+			if (j == tp->sfrom)
+				tp->sfrom++;
+			continue;
+		}
+		hv = hash(p->nval);
+		ls = spillfind(tp, p->nval, hv, SHADOW);
+		if (ls != NULL && tp->iter > 0 && tp->ocur >= 0
+		    && (offof(ls) & ~SHADOW) > tp->ocur)
+			continue;	/* the loop has yet to reach its record */
+		r.klen = strlen(p->nval);
+		r.tval = p->tval & (NUM|STR);
+		if (p->tval & CONV)
+			r.tval &= ~STR;
+		r.slen = r.tval & STR ? strlen(p->sval) : 0;
+		r.fval = p->fval;
+		n = sizeof(Srec) + r.klen + r.slen + 2;
+		freed += cellsize(p) + (tp->iwalk == 0 ? sizeof(Cell *) : 0);
+		if (ls != NULL)
+			sp->nshadow--;
+		if (ls != NULL && samerec(sp, (offof(ls) & ~SHADOW) - 1, &r, p))
+			setoff(ls, offof(ls) & ~SHADOW);	/* unchanged since it came back */
+		else {
+			if (len + n > SPILLBUF) {
+				spillwrite(sp, buf, len, base);
+				base += len;
+				len = 0;
+			}
+			rec = n > SPILLBUF ? (char *) malloc(n) : buf + len;
+			if (rec == NULL)
+				FATAL("out of space spilling array");
+			memcpy(rec, &r, sizeof(Srec));
+			memcpy(rec + sizeof(Srec), p->nval, r.klen + 1);
+			memcpy(rec + sizeof(Srec) + r.klen + 1, r.slen ? p->sval : "", r.slen + 1);
+			off = base + len;
+			if (n > SPILLBUF) {	/* too big to buffer */
+				spillwrite(sp, rec, n, off);
+				free(rec);
+				base += n;
+			} else
+				len += n;
+			if (ls != NULL)	/* it came back from the log before */
+				setoff(ls, off + 1);
+			else
+				spillput(sp, hv, off + 1);
+		}
+		tp->nspill++;
+		if ((st = slotof(tp, p->nval, hv)) == NULL)
+			FATAL("can't happen: array element %s not in index", p->nval);
+		st->ix = SGONE;
+		tp->elem[j] = NULL;
+		tp->nelem--;
+		dropelem(tp, p);
+		if (j == tp->sfrom)
+			tp->sfrom++;
+	}
+	if (len > 0)
+		spillwrite(sp, buf, len, base);
+	sp->end = base + len;
+	free(buf);
+	if (from == 0 && tp->nspill > nsp)
+		shrink(tp);
+}
+
+static long long growsoon(Array *tp)	/* what tp's tables will take on */
+{		/* when they next grow, if that's soon */
+	Spill *sp;
+	long long n = 0;
+	int i, k = tp->nelem / 16 + 16;	/* within this many new elements */
+
+	if (tp->slot != NULL && 2 * (tp->nfill + k) > tp->nslot)	/* as in growslots */
+		n += (long long) (4 * tp->nelem >= tp->nslot ? 2 : 1) * tp->nslot * sizeof(Slot);
+	if (tp->nused + k > tp->esize)
+		n += (long long) tp->esize * sizeof(Cell *);
+	if ((sp = tp->spill) != NULL) {	/* or if all that's in memory spilled */
+		k = tp->nelem / NLPART + 16;
+		for (i = 0; i < NLPART; i++)
+			if (8 * (sp->nfill[i] + k) > 7 * sp->nslot[i])	/* as in spillput */
+				n += (long long) ((sp->nfill[i] + k) / 2 * 3 - sp->nslot[i]) * sizeof(Lslot);
+	}
+	return n;
+}
+
+void arraycheck(void)	/* lru() evictions, -M budget; call only at safe points */
+{		/* the budget must hold between safe points too, so */
+	static int warned = 0;	/* growth that is near is counted in */
+	static long long wait = 0;	/* over, but can't help it: wait till here */
+	Array *tp, *big, *tried[8];
+	long long soon;
+	int i, ne, n = 0, pass;
+
+	if (evicting != NULL)
+		lrudrain();
+	if (arraybudget == 0)
+		return;
+	for (soon = 0, tp = arrays; tp != NULL; tp = tp->anext)
+		soon += growsoon(tp);
+	if (arraylive + soon <= arraybudget / 8 * 7	/* room for the log's index */
+	    || arraylive < wait)		/* to grow as this spills */
+		return;
+	for (pass = 0; arraylive + soon > arraybudget / 8 * 5 && n < 8 && pass < 16; pass++) {
+		big = NULL;	/* biggest that still gives something up */
+		for (tp = arrays; tp != NULL; tp = tp->anext) {
+			if (!spillable(tp) || tp->iter > 1 || tp->nelem == 0)
+				continue;	/* too busy */
+			for (i = 0; i < n && tried[i] != tp; i++)
+				;
+			if (i == n && (big == NULL || tp->nelem > big->nelem))
+				big = tp;
+		}
+		if (big == NULL)
+			break;
+		ne = big->nelem;
+		soon -= growsoon(big);
+		spillarray(big, arraybudget / 8 * 5 - soon - growsoon(big), 0);
+		soon += growsoon(big);
+		if (big->nelem == ne)
+			tried[n++] = big;
+	}
+	wait = arraylive + soon > arraybudget / 8 * 7 ? arraylive + arraybudget / 16 : 0;
+	if (arraylive > arraybudget && !warned++)
+		WARNING("arrays are over the -M limit but can't be spilled");
+}
+
+void arrayfilling(Array *tp, int from)	/* -M: a builtin is putting elem[from] on */
+{		/* into tp; it may hold any element, so only those may go */
+	if (arraybudget > 0 && spillable(tp)
+	    && arraylive + growsoon(tp) > arraybudget / 8 * 7)
+		spillarray(tp, arraybudget / 8 * 5 - growsoon(tp), from);
+}
+
+void unshadow(Array *tp)	/* the last for (k in tp) is done: elements that */
+{		/* came back during it are only in memory now */
+	Spill *sp = tp->spill;
+	int i, k;
+
+	if (tp->iter > 0 || sp == NULL || sp->nshadow == 0)
+		return;
+	for (k = 0; k < NLPART; k++)
+		for (i = 0; i < sp->nslot[k]; i++)
+			if (offof(&sp->slot[k][i]) > 0 && (offof(&sp->slot[k][i]) & SHADOW))
+				setoff(&sp->slot[k][i], -1);
+	sp->nshadow = 0;
+}
+
+long long spillend(Array *tp)	/* length of tp's log; for (k in tp) reads up to here */
+{
+	return tp->spill ? tp->spill->end : 0;
+}
+
+char *spillnext(Array *tp, long long *offp)
+{		/* key of the record at *offp, or NULL if it's not live; move *offp on */
+	Srec r;
+
+	return spillrecnext(tp, offp, &r);
+}
+
+static char *spillrecnext(Array *tp, long long *offp, Srec *rp)
+{		/* spillnext, and the record's head too */
+	Spill *sp = tp->spill;
+	Lslot *st;
+	Srec r;
+	char *k;
+	long long off = *offp, o;
+	unsigned long long hv;
+	unsigned i, m;
+	size_t n;
+
+	if (off < sp->dead)	/* no live records down there */
+		off = sp->dead;
+	if (off >= sp->end) {
+		*offp = off;
+		return NULL;
+	}
+	if (sp->rbuf == NULL && (sp->rbuf = (char *) malloc(SPILLBUF)) == NULL)
+		FATAL("out of space reading array spill file");
+	if (off < sp->rstart || off + (long long) sizeof(Srec) > sp->rend) {
+		n = sp->end - off < SPILLBUF ? sp->end - off : SPILLBUF;
+		spillread(sp, sp->rbuf, n, off);
+		sp->rstart = off;
+		sp->rend = off + n;
+	}
+	memcpy(&r, sp->rbuf + (off - sp->rstart), sizeof(Srec));
+	n = sizeof(Srec) + r.klen + r.slen + 2;
+	*offp = off + n;
+	if (off + (long long) n <= sp->rend)
+		k = sp->rbuf + (off - sp->rstart) + sizeof(Srec);
+	else	/* runs past the buffer */
+		k = spillrec(sp, off, &r);
+	*rp = r;
+	hv = hash(k);
+	st = sp->slot[LPART(hv)];
+	m = sp->nslot[LPART(hv)];
+	for (i = lhome(hv, m); (o = offof(&st[i])) != 0; i = i + 1 < m ? i + 1 : 0)
+		if (st[i].hv == (unsigned) hv && o > 0 && (o & ~SHADOW) == off + 1)
+			return k;
+	if (off == sp->dead)
+		sp->dead = *offp;
+	return NULL;	/* deleted, or spilled again further on */
+}
+
+static char *maprec(Attach *m, long long off, Srec *r)	/* key of record at off */
+{
+	if (off < (long long) sizeof(Ahead) || off + sizeof(Srec) > m->len)
+		FATAL("attached array file is damaged");
+	memcpy(r, m->base + off, sizeof(Srec));
+	if (r->klen < 0 || r->slen < 0
+	    || off + sizeof(Srec) + r->klen + r->slen + 2 > m->len)
+		FATAL("attached array file is damaged");
+	return m->base + off + sizeof(Srec);
+}
+
+static long long mapfind(Attach *m, const char *s, unsigned long long hv)
+{		/* slot of s in m, or -1; keys are there once, whatever m->state says */
+	Srec r;
+	long long i, mask = m->nslot - 1;
+
+	for (i = hv & mask; m->slot[i].off != 0; i = (i + 1) & mask)
+		if (m->slot[i].hv == hv && strcmp(s, maprec(m, m->slot[i].off, &r)) == 0)
+			return i;
+	return -1;
+}
+
+static Cell *unmap(Array *tp, const char *s, unsigned long long hv)
+{		/* copy s from the attached file into memory, if it's there */
+	Attach *m = tp->map;
+	Srec r;
+	char *k;
+	long long i;
+
+	if ((i = mapfind(m, s, hv)) < 0 || m->state[i] != 0)
+		return NULL;
+	k = maprec(m, m->slot[i].off, &r);
+	m->state[i] = MMOVED;
+	tp->nmap--;
+	return newcell(tp, s, hv, -1, r.tval & STR ? k + r.klen + 1 : NULL,
+		r.fval, r.tval);
+}
+
+static void unattach(Array *tp)	/* forget tp's file */
+{
+	Attach *m = tp->map;
+
+	munmap(m->base, m->len);
+	free(m->state);
+	free(m);
+	tp->map = NULL;
+	tp->nmap = 0;
+}
+
+int mapped(Array *tp, const char *s)	/* is element s a copy from tp's file? */
+{
+	long long i;
+
+	return tp->map != NULL && (i = mapfind(tp->map, s, hash(s))) >= 0
+		&& tp->map->state[i] == MMOVED;
+}
+
+char *mapnext(Array *tp, long long *ip)
+{		/* key of the first element at or after slot *ip of tp's file */
+	Attach *m = tp->map;	/* that hasn't been deleted; NULL at the end */
+	Srec r;
+	long long i;
+
+	for (i = *ip; m != NULL && i < m->nslot; i++)
+		if (m->slot[i].off != 0 && m->state[i] != MGONE) {
+			*ip = i + 1;
+			return maprec(m, m->slot[i].off, &r);
+		}
+	return NULL;
+}
+
+static long long dumprec(FILE *fp, const char *file, const char *key, const char *val, Srec *r)
+{		/* append key and its value (r, and val if STR) to fp; its length */
+	r->klen = strlen(key);
+	r->slen = r->tval & STR ? strlen(val) : 0;
+	if (fwrite(r, sizeof(Srec), 1, fp) != 1
+	    || fwrite(key, 1, r->klen + 1, fp) != (size_t) r->klen + 1
+	    || fwrite(r->slen ? val : "", 1, r->slen + 1, fp) != (size_t) r->slen + 1)
+		FATAL("write error on %s", file);
+	return sizeof(Srec) + r->klen + r->slen + 2;
+}
+
+static void slotput(Sslot *st, long long n, unsigned long long hv, long long off)
+{
+	long long i;
+
+	for (i = hv & (n - 1); st[i].off != 0; i = (i + 1) & (n - 1))
+		;
+	st[i].hv = hv;
+	st[i].off = off;
+}
+
+long long dumparray(Array *tp, const char *file)	/* write tp to file; see attach */
+{
+	FILE *fp;
+	Ahead h;
+	Attach *am;
+	Sslot *st;
+	Srec r;
+	Cell *p;
+	char nbuf[50], *tmp, *k;
+	long long n, i, m, off;
+
+	n = tp->nelem + tp->nspill + tp->nmap;
+	for (m = 8; m < 2 * n; m *= 2)
+		;
+	if ((st = (Sslot *) calloc(m, sizeof(Sslot))) == NULL
+	    || (tmp = (char *) malloc(strlen(file) + 8)) == NULL)
+		FATAL("out of space dumping array of %lld elements", n);
+	sprintf(tmp, "%s.tmp", file);	/* then rename, so no one sees half a file */
+	if ((fp = fopen(tmp, "w")) == NULL)
+		FATAL("can't open file %s", tmp);
+	off = sizeof(Ahead) + m * sizeof(Sslot);
+	if (fseek(fp, off, SEEK_SET) != 0)
+		FATAL("can't seek on %s", tmp);
+	for (i = 0; i < tp->nused; i++) {	/* what's in memory */
+		if ((p = tp->elem[i]) == NULL)
+			continue;
+		if ((k = p->nval) == NULL)
+			itos(k = nbuf, (long long) tp->lo + i);
+		r.tval = p->tval & (NUM|STR);
+		if (p->tval & CONV)
+			r.tval &= ~STR;
+		r.fval = p->fval;
+		slotput(st, m, hash(k), off);
+		off += dumprec(fp, tmp, k, p->sval, &r);
+	}
+	for (i = 0; tp->spill != NULL && i < tp->spill->end; ) {	/* in the log */
+		if ((k = spillrecnext(tp, &i, &r)) == NULL)
+			continue;
+		slotput(st, m, hash(k), off);
+		off += dumprec(fp, tmp, k, k + r.klen + 1, &r);
+	}
+	for (i = 0, am = tp->map; am != NULL && i < am->nslot; i++) {	/* in a file */
+		if (am->slot[i].off == 0 || am->state[i] != 0)
+			continue;
+		k = maprec(am, am->slot[i].off, &r);
+		slotput(st, m, am->slot[i].hv, off);
+		off += dumprec(fp, tmp, k, k + r.klen + 1, &r);
+	}
+	memcpy(h.magic, AMAGIC, sizeof(h.magic));
+	h.nslot = m;
+	h.nelem = n;
+	rewind(fp);
+	if (fwrite(&h, sizeof(Ahead), 1, fp) != 1 || fwrite(st, sizeof(Sslot), m, fp) != (size_t) m
+	    || fclose(fp) == EOF)
+		FATAL("write error on %s", tmp);
+	if (rename(tmp, file) == -1)
+		FATAL("can't rename %s to %s", tmp, file);
+	free(st);
+	free(tmp);
+	return n;
+}
+
+long long attacharray(Cell *ap, const char *file)
+{		/* make ap the array dumped in file; -1 if it can't be opened */
+	Array *tp;
+	Attach *m;
+	Ahead h;
+	struct stat sb;
+	void *base;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &sb) < 0 || sb.st_size < (off_t) sizeof(Ahead)
+	    || pread(fd, &h, sizeof(Ahead), 0) != sizeof(Ahead)
+	    || memcmp(h.magic, AMAGIC, sizeof(h.magic)) != 0
+	    || h.nslot < 8 || (h.nslot & (h.nslot - 1)) != 0 || h.nelem < 0
+	    || h.nslot > (sb.st_size - (off_t) sizeof(Ahead)) / (off_t) sizeof(Sslot))
+		FATAL("%s is not an array file written by dump", file);
+	base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		FATAL("can't map %s", file);
+	if ((m = (Attach *) malloc(sizeof(Attach))) == NULL
+	    || (m->state = (unsigned char *) calloc(h.nslot, 1)) == NULL)
+		FATAL("out of space attaching %s", file);
+	m->base = (char *) base;
+	m->len = sb.st_size;
+	m->slot = (Sslot *) (m->base + sizeof(Ahead));
+	m->nslot = h.nslot;
+	if (isarr(ap))
+		freesymtab(ap);
+	else if (freeable(ap))
+		xfree(ap->sval);
+	ap->tval &= ~(STR|NUM|DONTFREE|CONV);
+	ap->tval |= ARR;
+	ap->sval = (char *) (tp = makesymtab(NSYMTAB));
+	undense(tp);	/* keys come from the file: no dense tricks */
+	tp->map = m;
+	tp->nmap = h.nelem;
+	return h.nelem;
+}
+
+static void unevict(Array *tp)	/* take tp off the evicting list */
+{
+	Array **pp;
+
+	for (pp = &evicting; *pp != NULL; pp = &(*pp)->enext)
+		if (*pp == tp) {
+			*pp = tp->enext;
+			break;
+		}
+	tp->enext = NULL;
+}
+
+static void lruevict(Array *tp)	/* evict tp's least recently used element */
+{
+	Slot *st;
+	Cell *p;
+
+	while (tp->elem[tp->sfrom] == NULL)
+		tp->sfrom++;
+	p = tp->elem[tp->sfrom];
+	if ((st = slotof(tp, p->nval, hash(p->nval))) == NULL)
+		FATAL("can't happen: array element %s not in index", p->nval);
+	st->ix = SGONE;
+	tp->elem[tp->sfrom++] = NULL;
+	tp->nelem--;
+	tp->gen = ++arraygen;
+	if (tp->last == p)
+		tp->last = NULL;
+	if (tp->nevict == 0) {
+		tp->evfirst = 0;
+		tp->enext = evicting;
+		evicting = tp;
+	} else if (tp->evfirst + tp->nevict >= tp->evsize && tp->evfirst > 0) {
+		memmove(tp->evict, tp->evict + tp->evfirst, tp->nevict * sizeof(Cell *));
+		tp->evfirst = 0;
+	}
+	if (tp->evfirst + tp->nevict >= tp->evsize) {
+		tp->evsize = 2 * tp->evsize + 16;
+		tp->evict = (Cell **) realloc(tp->evict, tp->evsize * sizeof(Cell *));
+		if (tp->evict == NULL)
+			FATAL("out of space evicting from array");
+	}
+	tp->evict[tp->evfirst + tp->nevict++] = p;
+	if (tp->lrufcn == NULL && tp->nevict > LRUSLACK) {	/* long enough */
+		p = tp->evict[tp->evfirst++];
+		tp->nevict--;
+		dropelem(tp, p);
+	}
+}
+
+void lruarray(Cell *ap, int n, Cell *fcn)	/* lru(a, n, fcn) */
+{
+	Array *tp;
+
+	if (!isarr(ap)) {
+		if (freeable(ap))
+			xfree(ap->sval);
+		ap->tval &= ~(STR|NUM|DONTFREE|CONV);
+		ap->tval |= ARR;
+		ap->sval = (char *) makesymtab(NSYMTAB);
+	}
+	tp = (Array *) ap->sval;
+	if (tp->slot == NULL)
+		undense(tp);	/* needs nval to evict by */
+	tp->lrucap = n > 0 ? n : 0;
+	tp->lrufcn = fcn;
+	while (tp->lrucap > 0 && tp->nelem > tp->lrucap)
+		lruevict(tp);
+}
+
+static void lrudrain(void)	/* hand evicted elements to lru functions; free them */
+{
+	Array *tp;
+	Cell *p, *fcn, *args[2];
+
+	while ((tp = evicting) != NULL) {
+		p = tp->evict[tp->evfirst++];
+		if (--tp->nevict == 0) {
+			evicting = tp->enext;
+			tp->enext = NULL;
+		}
+		if ((fcn = tp->lrufcn) != NULL) {	/* copy; fcn may change tp */
+			setsval(&lrukey, p->nval);
+			if ((p->tval & (NUM|STR|CONV)) == (NUM|STR)) {
+				setsval(&lruval, p->sval);
+				lruval.fval = p->fval;
+				lruval.tval |= NUM;
+			} else if (p->tval & NUM)
+				setfval(&lruval, p->fval);
+			else
+				setsval(&lruval, p->sval);
+		}
+		dropelem(tp, p);
+		if (fcn != NULL) {
+			args[0] = &lrukey;
+			args[1] = &lruval;
+			callfcn(fcn, args, 2);
+		}
+	}
+}
+
+/* sorting, for asort, asorti and sorted for (k in a) */
+
+#define	SVAL	01	/* by value, not key */
+#define	SNUM	02	/* as numbers */
+#define	STYPE	04	/* numbers first, then strings */
+#define	SDESC	010	/* largest first */
+#define	SNONE	020	/* in the order for (k in a) takes */
+#define	POOLSIZE 65536	/* bytes in a pool block */
+
+typedef struct Apool {		/* a block of copied strings */
+	struct Apool *next;
+	char	*p;		/* free space */
+	size_t	left;
+} Apool;
+
+typedef struct Rkey {		/* for radix sorting numbers */
+	unsigned long long u;	/* compares as the number does */
+	int	i;		/* item */
+} Rkey;
+
+typedef struct Skey {		/* for sorting strings */
+	const unsigned char *s;
+	int	i;
+	unsigned int c;		/* 4 characters of s from where the sort is */
+} Skey;
+
+static struct {
+	const char *name;
+	int	mode;
+} sortmodes[] = {		/* orders named as in gawk */
+	{ "@unsorted",		SNONE },
+	{ "@ind_str_asc",	0 },
+	{ "@ind_str_desc",	SDESC },
+	{ "@ind_num_asc",	SNUM },
+	{ "@ind_num_desc",	SNUM|SDESC },
+	{ "@val_str_asc",	SVAL },
+	{ "@val_str_desc",	SVAL|SDESC },
+	{ "@val_num_asc",	SVAL|SNUM },
+	{ "@val_num_desc",	SVAL|SNUM|SDESC },
+	{ "@val_type_asc",	SVAL|STYPE },
+	{ "@val_type_desc",	SVAL|STYPE|SDESC },
+};
+
+static Cell *sortfcn;		/* comparison function being used */
+static Asort *sortas;		/* on these items */
+static Cell sortarg[4] = {
+	{ OCELL, CCON, NULL, "", 0.0, STR|DONTFREE },
+	{ OCELL, CCON, NULL, "", 0.0, STR|DONTFREE },
+	{ OCELL, CCON, NULL, "", 0.0, STR|DONTFREE },
+	{ OCELL, CCON, NULL, "", 0.0, STR|DONTFREE },
+};
+
+static int sortmode(const char *how, Cell **fcnp)	/* decode an order */
+{		/* how is one of sortmodes, or the name of a function */
+	int i;
+
+	*fcnp = NULL;
+	for (i = 0; i < sizeof(sortmodes) / sizeof(sortmodes[0]); i++)
+		if (strcmp(how, sortmodes[i].name) == 0)
+			return sortmodes[i].mode;
+	if (*how == '@' || (*fcnp = lookup(how, symtab)) == NULL || !isfcn(*fcnp))
+		FATAL("can't sort by %s: not an order or a function", how);
+	return SVAL;
+}
+
+static char *pooldup(Asort *as, const char *s)	/* copy s into as's pool */
+{
+	Apool *p = as->pool, *q;
+	size_t n = strlen(s) + 1, m;
+
+	if (p == NULL || p->left < n) {
+		m = n > POOLSIZE / 4 ? n : POOLSIZE;
+		if ((q = (Apool *) malloc(sizeof(Apool) + m)) == NULL)
+			FATAL("out of space sorting array");
+		q->p = (char *) (q + 1);
+		q->left = m;
+		if (p != NULL && m == n) {	/* a big one; keep p's room */
+			q->next = p->next;
+			p->next = q;
+		} else {
+			q->next = p;
+			as->pool = q;
+		}
+		p = q;
+	}
+	memcpy(p->p, s, n);
+	p->p += n;
+	p->left -= n;
+	return p->p - n;
+}
+
+static void additem(Asort *as, const char *k, const char *s, Awkfloat f, int t, int val)
+{		/* t is NUM|STR as in Srec; val: keep the value */
+	Sitem *it;
+
+	if (as->n >= as->size) {
+		as->size = as->size * 2 + 16;
+		as->item = (Sitem *) realloc(as->item, as->size * sizeof(Sitem));
+		if (as->item == NULL)
+			FATAL("out of space sorting array");
+	}
+	it = &as->item[as->n++];
+	it->k = pooldup(as, k);
+	it->s = val && (t & STR) ? pooldup(as, s) : NULL;
+	it->f = f;
+	it->tval = t;
+}
+
+static Asort *collect(Array *tp, int val)	/* copy tp's elements */
+{
+	Asort *as;
+	Attach *m;
+	Cell *p;
+	Srec r;
+	long long off, end, i;
+	unsigned long long hv;
+	char nbuf[NUMBUFSZ], *k;
+	int j, t;
+
+	if ((as = (Asort *) calloc(1, sizeof(Asort))) == NULL)
+		FATAL("out of space sorting array");
+	as->size = tp->nelem + tp->nspill + tp->nmap;
+	if ((as->item = (Sitem *) malloc((as->size + 1) * sizeof(Sitem))) == NULL)
+		FATAL("out of space sorting array");
+	for (j = tp->sfrom; j < tp->nused; j++) {
+		if ((p = tp->elem[j]) == NULL)
+			continue;
+		if ((k = p->nval) == NULL)	/* dense */
+			itos(k = nbuf, (long long) tp->lo + j);
+		t = p->tval & (NUM|STR);
+		if (p->tval & CONV)
+			t &= ~STR;
+		additem(as, k, p->sval, p->fval, t, val);
+	}
+	end = spillend(tp);
+	for (off = 0; tp->spill != NULL && off < end; )
+		if ((k = spillrecnext(tp, &off, &r)) != NULL
+		    && (tp->iter == 0 || find(tp, k, &hv, 0) == NULL))
+			additem(as, k, k + r.klen + 1, r.fval, r.tval, val);
+	for (i = 0, m = tp->map; m != NULL && i < m->nslot; i++)
+		if (m->slot[i].off != 0 && m->state[i] == 0) {
+			k = maprec(m, m->slot[i].off, &r);
+			additem(as, k, k + r.klen + 1, r.fval, r.tval, val);
+		}
+	return as;
+}
+
+static unsigned long long fbits(Awkfloat f)	/* f's bits, ordered as f is */
+{
+	unsigned long long u;
+
+	if (f == 0)
+		f = 0;	/* -0 with 0 */
+	memcpy(&u, &f, sizeof(u));
+	return u >> 63 ? ~u : u | 1ULL << 63;
+}
+
+static void radixsort(Rkey *a, int n)	/* stable, least significant byte first */
+{
+	static int cnt[8][256];
+	Rkey *b, *from, *to, *t;
+	int i, d, c, s;
+
+	memset(cnt, 0, sizeof(cnt));
+	for (i = 0; i < n; i++)
+		for (d = 0; d < 8; d++)
+			cnt[d][a[i].u >> 8*d & 0xff]++;
+	if ((b = (Rkey *) malloc(n * sizeof(Rkey))) == NULL)
+		FATAL("out of space sorting array");
+	from = a;
+	to = b;
+	for (d = 0; d < 8; d++) {
+		if (cnt[d][a[0].u >> 8*d & 0xff] == n)
+			continue;	/* all the same */
+		for (c = s = 0; c < 256; c++) {
+			i = cnt[d][c];
+			cnt[d][c] = s;
+			s += i;
+		}
+		for (i = 0; i < n; i++)
+			to[cnt[d][from[i].u >> 8*d & 0xff]++] = from[i];
+		t = from;
+		from = to;
+		to = t;
+	}
+	if (from != a)
+		memcpy(a, from, n * sizeof(Rkey));
+	free(b);
+}
+
+static void kswap(Skey *a, int i, int j, int n)	/* a[i..i+n) <-> a[j..j+n) */
+{
+	Skey t;
+
+	for ( ; n > 0; n--, i++, j++) {
+		t = a[i];
+		a[i] = a[j];
+		a[j] = t;
+	}
+}
+
+static unsigned int kchars(const unsigned char *s)	/* s[0..4) as a number */
+{		/* 0s after its end */
+	unsigned int c = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		c <<= 8;
+		if (*s)
+			c |= *s++;
+	}
+	return c;
+}
+
+static int kcmp(Skey *a, Skey *b, int d)	/* compare strings that agree below d */
+{
+	if (a->c != b->c)
+		return a->c < b->c ? -1 : 1;
+	if ((a->c & 0xff) == 0)	/* both end here */
+		return 0;
+	return strcmp((char *) a->s + d + 4, (char *) b->s + d + 4);
+}
+
+static void mkqsort(Skey *a, int n, int d)	/* a[].s all agree below d */
+{		/* Bentley and Sedgewick's multikey quicksort, but on the */
+	int i, j, lt, le, gt, ge, r;	/* 4 characters from d cached in c */
+	unsigned int v;
+	Skey t;
+
+	while (n > 12) {
+		i = n / 2;	/* pivot: median of 3 */
+		if (a[0].c > a[i].c)
+			kswap(a, 0, i, 1);
+		if (a[i].c > a[n-1].c)
+			kswap(a, i, n-1, 1);
+		if (a[0].c > a[i].c)
+			kswap(a, 0, i, 1);
+		kswap(a, 0, i, 1);
+		v = a[0].c;
+		le = lt = 1;
+		gt = ge = n - 1;
+		for (;;) {
+			for ( ; lt <= gt && a[lt].c <= v; lt++)
+				if (a[lt].c == v)
+					kswap(a, le++, lt, 1);
+			for ( ; lt <= gt && a[gt].c >= v; gt--)
+				if (a[gt].c == v)
+					kswap(a, gt, ge--, 1);
+			if (lt > gt)
+				break;
+			kswap(a, lt++, gt--, 1);
+		}
+		r = le < lt - le ? le : lt - le;
+		kswap(a, 0, lt - r, r);
+		r = ge - gt < n - ge - 1 ? ge - gt : n - ge - 1;
+		kswap(a, lt, n - r, r);
+		mkqsort(a, lt - le, d);	/* less than v */
+		if ((v & 0xff) != 0) {	/* equal to v; on to the next 4 */
+			for (i = lt - le, j = i + le + n - ge - 1; i < j; i++)
+				a[i].c = kchars(a[i].s + d + 4);
+			mkqsort(a + lt - le, le + n - ge - 1, d + 4);
+		}
+		r = ge - gt;	/* greater than v */
+		a += n - r;
+		n = r;
+	}
+	for (i = 1; i < n; i++) {	/* insertion sort for the little ones */
+		t = a[i];
+		for (j = i; j > 0 && kcmp(&a[j-1], &t, d) > 0; j--)
+			a[j] = a[j-1];
+		a[j] = t;
+	}
+}
+
+static void numorder(Asort *as, int *ix, int n, int mode)	/* sort ix by number */
+{
+	Rkey *k;
+	Sitem *it;
+	int i;
+
+	if ((k = (Rkey *) malloc((n + 1) * sizeof(Rkey))) == NULL)
+		FATAL("out of space sorting array");
+	for (i = 0; i < n; i++) {
+		it = &as->item[ix[i]];
+		if (!(mode & SVAL))
+			k[i].u = fbits(atof(it->k));
+		else
+			k[i].u = fbits(it->tval & NUM ? it->f : atof(it->s));
+		if (mode & SDESC)
+			k[i].u = ~k[i].u;
+		k[i].i = ix[i];
+	}
+	if (n > 1)
+		radixsort(k, n);
+	for (i = 0; i < n; i++)
+		ix[i] = k[i].i;
+	free(k);
+}
+
+static void strorder(Asort *as, int *ix, int n, int mode)	/* sort ix by string */
+{
+	Skey *k;
+	Sitem *it;
+	char buf[NUMBUFSZ];
+	int i;
+
+	if ((k = (Skey *) malloc((n + 1) * sizeof(Skey))) == NULL)
+		FATAL("out of space sorting array");
+	for (i = 0; i < n; i++) {
+		it = &as->item[ix[i]];
+		if (!(mode & SVAL))
+			k[i].s = (unsigned char *) it->k;
+		else {
+			if (!(it->tval & STR))
+				it->s = pooldup(as, fmtnum(buf, it->f, *CONVFMT));
+			k[i].s = (unsigned char *) it->s;
+		}
+		k[i].c = kchars(k[i].s);
+		k[i].i = ix[i];
+	}
+	mkqsort(k, n, 0);
+	for (i = 0; i < n; i++)
+		ix[i] = k[(mode & SDESC) ? n - 1 - i : i].i;
+	free(k);
+}
+
+static void itemval(Cell *vp, Sitem *it)	/* vp = it's value, with its type */
+{
+	if ((it->tval & (NUM|STR)) == (NUM|STR)) {
+		setsval(vp, it->s);
+		vp->fval = it->f;
+		vp->tval |= NUM;
+	} else if (it->tval & NUM)
+		setfval(vp, it->f);
+	else
+		setsval(vp, it->s);
+}
+
+static int fcncmp(int i, int j)	/* sortfcn(i's key, value, j's key, value) */
+{
+	Cell *v[4];
+	Awkfloat r;
+	int n;
+
+	for (n = 0; n < 4; n++)
+		v[n] = &sortarg[n];
+	setsval(v[0], sortas->item[i].k);
+	itemval(v[1], &sortas->item[i]);
+	setsval(v[2], sortas->item[j].k);
+	itemval(v[3], &sortas->item[j]);
+	r = callfcn(sortfcn, v, 4);
+	return r < 0 ? -1 : r > 0;
+}
+
+static void fcnorder(int *ix, int *t, int n)	/* merge sort ix with sortfcn */
+{
+	int i, j, k, m = n / 2;
+
+	if (n < 2)
+		return;
+	fcnorder(ix, t, m);
+	fcnorder(ix + m, t, n - m);
+	if (fcncmp(ix[m-1], ix[m]) <= 0)
+		return;	/* already in order */
+	for (i = k = 0, j = m; i < m && j < n; )
+		t[k++] = fcncmp(ix[j], ix[i]) < 0 ? ix[j++] : ix[i++];
+	while (i < m)
+		t[k++] = ix[i++];
+	memcpy(ix, t, k * sizeof(int));	/* the rest are in place */
+}
+
+Asort *sortarray(Array *tp, const char *how, int val)
+{		/* copies of tp's elements, in the order how names */
+	Asort *as;	/* val: copy values too */
+	Sitem *it;
+	Cell *fcn;
+	int *ix, *t, i, j, n, nn, mode;
+
+	mode = sortmode(how, &fcn);
+	as = collect(tp, val || (mode & SVAL));
+	if ((mode & SNONE) || (n = as->n) < 2)
+		return as;
+	if ((ix = (int *) malloc(2 * n * sizeof(int))) == NULL)
+		FATAL("out of space sorting array");
+	t = ix + n;
+	if (fcn != NULL) {
+		for (i = 0; i < n; i++)
+			ix[i] = i;
+		sortfcn = fcn;
+		sortas = as;
+		fcnorder(ix, t, n);
+	} else if (mode & STYPE) {	/* numbers, then strings; or reversed */
+		for (i = nn = 0; i < n; i++)
+			if (((as->item[i].tval & NUM) != 0) != ((mode & SDESC) != 0))
+				ix[nn++] = i;
+		for (i = 0, j = nn; i < n; i++)
+			if (((as->item[i].tval & NUM) != 0) == ((mode & SDESC) != 0))
+				ix[j++] = i;
+		if (mode & SDESC) {
+			strorder(as, ix, nn, mode);
+			numorder(as, ix + nn, n - nn, mode);
+		} else {
+			numorder(as, ix, nn, mode);
+			strorder(as, ix + nn, n - nn, mode);
+		}
+	} else {
+		for (i = 0; i < n; i++)
+			ix[i] = i;
+		if (mode & SNUM)
+			numorder(as, ix, n, mode);
+		else
+			strorder(as, ix, n, mode);
+	}
+	if ((it = (Sitem *) malloc(n * sizeof(Sitem))) == NULL)
+		FATAL("out of space sorting array");
+	for (i = 0; i < n; i++)
+		it[i] = as->item[ix[i]];
+	free(as->item);
+	as->item = it;
+	as->size = n;
+	free(ix);
+	return as;
+}
+
+void freesort(Asort *as)
+{
+	Apool *p, *q;
+
+	for (p = as->pool; p != NULL; p = q) {
+		q = p->next;
+		free(p);
+	}
+	free(as->item);
+	free(as);
+}
+
+char *sortedin(void)	/* PROCINFO["sorted_in"], if for-in loops are sorted */
+{
+	Cell *p;
+	char *s;
+
+	if (!isarr(procinfoloc)
+	    || (p = lookup("sorted_in", (Array *) procinfoloc->sval)) == NULL)
+		return NULL;
+	s = getsval(p);
+	return *s != '\0' && strcmp(s, "@unsorted") != 0 ? s : NULL;
+}
+
+int asortarray(Cell *src, Cell *dest, const char *how, int ind)
+{		/* asort, or asorti if ind: dest[1..n] = src's values (keys) in order */
+	Asort *as;
+	Array *tp;
+	Sitem *it;
+	char nbuf[NUMBUFSZ];
+	int i, n;
+
+	if (!isarr(src))
+		FATAL("can't sort %s: not an array", NN(src->nval));
+	if (how == NULL)
+		how = ind ? "@ind_str_asc" : "@val_type_asc";
+	as = sortarray((Array *) src->sval, how, !ind);
+	if (isarr(dest))
+		freesymtab(dest);
+	else if (freeable(dest))
+		xfree(dest->sval);
+	dest->tval &= ~(STR|NUM|DONTFREE|CONV);
+	dest->tval |= ARR;
+	dest->sval = (char *) (tp = makesymtab(NSYMTAB));
+	arrayreserve(tp, n = as->n);
+	for (i = 0; i < n; i++) {
+		it = &as->item[i];
+		itos(nbuf, (long long) i + 1);
+		if (ind)
+			setsymtab(nbuf, it->k, 0.0, STR, tp);
+		else
+			setsymtab(nbuf, it->s, it->f, it->tval, tp);
+	}
+	freesort(as);
+	return n;
+}
+
+static Cell *newcell(Array *tp, const char *n, unsigned long long hv, int i,
+	const char *s, Awkfloat f, unsigned t)	/* add n, not yet in tp */
+{		/* i is its place if tp is dense, else -1 and hv is its hash */
+	Cell *p;
+
+	p = newelem(tp, i < 0 ? n : NULL);
+	if (s == NULL)
+		s = "";
+	if (!p->celem && strlen(s) < sizeof(p->nbuf)) {	/* short values live in the Cell */
+		strcpy(p->nbuf, s);
+		p->sval = p->nbuf;
+		t |= DONTFREE;
+	} else if ((t & STR) == 0 && *s == '\0') {	/* just a number: no string to keep */
+		p->sval = (char *) "";
+		t |= DONTFREE;
+	} else
+		p->sval = tostring(s);
 	p->fval = f;
 	p->tval = t;
+	p->cfmt = 0;
 	p->csub = CUNK;
 	p->ctype = OCELL;
+	svcharge(p, 1);
+	if (i >= 0) {		/* dense */
+		tp->elem[i] = p;
+		tp->nelem++;
+		return(p);
+	}
+	if (2 * (tp->nfill + 1) > tp->nslot)
+		growslots(tp);
+	if (tp->nused >= tp->esize)
+		growelem(tp);
+	tp->elem[tp->nused] = p;
+	tp->nfill += putslot(tp->slot, tp->nslot, hv, tp->nused);
+	tp->nused++;
 	tp->nelem++;
-	if (tp->nelem > FULLTAB * tp->size)
-		rehash(tp);
-	h = hash(n, tp->size);
-	p->cnext = tp->tab[h];
-	tp->tab[h] = p;
+	tp->last = p;
+	if (tp->oslot)
+		moveslots(tp, MOVESTEP);
+	if (tp->lrucap > 0 && tp->nelem > tp->lrucap)
+		lruevict(tp);
 	   dprintf( ("setsymtab set %p: n=%s s=\"%s\" f=%g t=%o\n",
 		(void*)p, p->nval, p->sval, p->fval, p->tval) );
 	return(p);
 }
 
-int hash(const char *s, int n)	/* form hash value for string s */
+Cell *setsymtab(const char *n, const char *s, Awkfloat f, unsigned t, Array *tp)
 {
-	unsigned hashval;
+	Cell *p;
+	unsigned long long hv = 0;
+	int k, i = -1;
 
-	for (hashval = 0; *s != '\0'; s++)
-		hashval = (*s + 31 * hashval);
-	return hashval % n;
+	if (tp->slot == NULL) {
+		if (intkey(n, &k) && (i = denseix(tp, k)) >= 0
+		    && (p = tp->elem[i]) != NULL)
+			return(p);
+		if (i < 0)
+			undense(tp);
+	}
+	if (i < 0) {
+		if ((p = find(tp, n, &hv, 1)) != NULL) {
+			   dprintf( ("setsymtab found %p: n=%s s=\"%s\" f=%g t=%o\n",
+				(void*)p, NN(p->nval), NN(p->sval), p->fval, p->tval) );
+			return(p);
+		}
+		if (tp->spill && (p = unspill(tp, n, hv)) != NULL)
+			return(p);
+		if (tp->map && (p = unmap(tp, n, hv)) != NULL)
+			return(p);
+	}
+	tp->gen = ++arraygen;
+	return newcell(tp, n, hv, i, s, f, t);
 }
 
-void rehash(Array *tp)	/* rehash items in small table into big one */
+/* the hash is a small relative of wyhash: two 64-bit words of key */
+/* at a time, each folded in with a 64x64->128-bit multiply. */
+
+#define	HK0	0xa0761d6478bd642fULL
+#define	HK1	0xe7037ed1a0b428dbULL
+#define	HK2	0x8ebc6af09c88c6e3ULL
+
+static unsigned long long hmix(unsigned long long a, unsigned long long b)
 {
-	int i, nh, nsz;
-	Cell *cp, *op, **np;
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t) a * b;
 
-	nsz = GROWTAB * tp->size;
-	np = (Cell **) calloc(nsz, sizeof(Cell *));
-	if (np == NULL)		/* can't do it, but can keep running. */
-		return;		/* someone else will run out later. */
-	for (i = 0; i < tp->size; i++) {
-		for (cp = tp->tab[i]; cp; cp = op) {
-			op = cp->cnext;
-			nh = hash(cp->nval, nsz);
-			cp->cnext = np[nh];
-			np[nh] = cp;
-		}
+	return (unsigned long long) r ^ (unsigned long long) (r >> 64);
+#else	/* the same 128-bit product, in 32-bit halves */
+	unsigned long long al = a & 0xffffffffULL, ah = a >> 32;
+	unsigned long long bl = b & 0xffffffffULL, bh = b >> 32;
+	unsigned long long ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+	unsigned long long mid = (ll >> 32) + (lh & 0xffffffffULL) + (hl & 0xffffffffULL);
+
+	return ((mid << 32) | (ll & 0xffffffffULL))
+	    ^ (hh + (lh >> 32) + (hl >> 32) + (mid >> 32));
+#endif
+}
+
+unsigned long long hash(const char *s)	/* form hash value for string s */
+{
+	size_t n, len;
+	unsigned long long h = HK0, a, b;
+
+	len = n = strlen(s);
+	for ( ; n > 16; n -= 16, s += 16) {
+		memcpy(&a, s, 8);
+		memcpy(&b, s + 8, 8);
+		h = hmix(a ^ HK1, b ^ h);
 	}
-	free(tp->tab);
-	tp->tab = np;
-	tp->size = nsz;
+	a = b = 0;
+	if (n > 8) {
+		memcpy(&a, s, 8);
+		memcpy(&b, s + 8, n - 8);
+	} else
+		memcpy(&a, s, n);
+	return hmix(hmix(a ^ HK1, b ^ h) ^ len, HK2);
 }
 
 Cell *lookup(const char *s, Array *tp)	/* look for s in tp */
 {
 	Cell *p;
-	int h;
+	unsigned long long hv;
+	int k;
 
-	h = hash(s, tp->size);
-	for (p = tp->tab[h]; p != NULL; p = p->cnext)
-		if (strcmp(s, p->nval) == 0)
-			return(p);	/* found it */
-	return(NULL);			/* not found */
+	if (tp->slot == NULL) {
+		if (!intkey(s, &k) || (k -= tp->lo) < 0 || k >= tp->nused)
+			return(NULL);
+		return tp->elem[k];
+	}
+	if ((p = find(tp, s, &hv, 1)) == NULL && tp->spill)
+		p = unspill(tp, s, hv);
+	if (p == NULL && tp->map)
+		p = unmap(tp, s, hv);
+	return p;
+}
+
+int inarray(const char *s, Array *tp)	/* is s in tp?  for "s in tp" */
+{
+	unsigned long long hv;
+	long long i;
+
+	if (tp->slot == NULL)
+		return lookup(s, tp) != NULL;
+	if (find(tp, s, &hv, 0) != NULL)
+		return 1;
+	if (tp->spill != NULL && spillfind(tp, s, hv, 0) != NULL)
+		return 1;
+	return tp->map != NULL && (i = mapfind(tp->map, s, hv)) >= 0
+		&& tp->map->state[i] == 0;
 }
 
 Awkfloat setfval(Cell *vp, Awkfloat f)	/* set float val of a Cell */
@@ -286,6 +2256,7 @@ Awkfloat setfval(Cell *vp, Awkfloat f)	/* set float val of a Cell */
 		funnyvar(vp, "assign to");
 	if (isfld(vp)) {
 		donerec = 0;	/* mark $0 invalid */
+		recgen++;
 		fldno = atoi(vp->nval);
 		if (fldno > *NF)
 			newfld(fldno);
@@ -293,10 +2264,19 @@ Awkfloat setfval(Cell *vp, Awkfloat f)	/* set float val of a Cell */
 	} else if (isrec(vp)) {
 		donefld = 0;	/* mark $1... invalid */
 		donerec = 1;
+		recgen++;
+	}
+	if (vp == convfmtloc || vp == ofmtloc)
+		lastfmt = NULL;
+	if ((vp->tval & (STR|CONV)) == (STR|CONV) && vp->fval == f
+	    && signbit(vp->fval) == signbit(f))
+		;	/* same number; converted string is still good */
+	else {
+		svcharge(vp, -1);
+		if (freeable(vp))
+			xfree(vp->sval); /* free any previous string */
+		vp->tval &= ~(STR|CONV);	/* mark string invalid */
 	}
-	if (freeable(vp))
-		xfree(vp->sval); /* free any previous string */
-	vp->tval &= ~STR;	/* mark string invalid */
 	vp->tval |= NUM;	/* mark number ok */
 	   dprintf( ("setfval %p: %s = %g, t=%o\n", (void*)vp, NN(vp->nval), f, vp->tval) );
 	return vp->fval = f;
@@ -309,13 +2289,25 @@ void funnyvar(Cell *vp, const char *rw)
 	if (vp->tval & FCN)
 		FATAL("can't %s %s; it's a function.", rw, vp->nval);
 	WARNING("funny variable %p: n=%s s=\"%s\" f=%g t=%o",
-		vp, vp->nval, vp->sval, vp->fval, vp->tval);
+		vp, NN(vp->nval), vp->sval, vp->fval, vp->tval);
 }
 
+static char *setsv(Cell *, const char *, int);
+
 char *setsval(Cell *vp, const char *s)	/* set string val of a Cell */
 {
-	char *t;
-	int fldno;
+	return setsv(vp, s, 0);
+}
+
+char *adoptsval(Cell *vp, char *s)	/* setsval, but vp takes over malloc'ed s */
+{
+	return setsv(vp, s, 1);
+}
+
+static char *setsv(Cell *vp, const char *s, int own)
+{
+	char *t, tmp[sizeof(vp->nbuf)];
+	int fldno, n;
 
 	   dprintf( ("starting setsval %p: %s = \"%s\", t=%o, r,f=%d,%d\n", 
 		(void*)vp, NN(vp->nval), s, vp->tval, donerec, donefld) );
@@ -323,6 +2315,7 @@ char *setsval(Cell *vp, const char *s)	/* set string val of a Cell */
 		funnyvar(vp, "assign to");
 	if (isfld(vp)) {
 		donerec = 0;	/* mark $0 invalid */
+		recgen++;
 		fldno = atoi(vp->nval);
 		if (fldno > *NF)
 			newfld(fldno);
@@ -330,16 +2323,36 @@ char *setsval(Cell *vp, const char *s)	/* set string val of a Cell */
 	} else if (isrec(vp)) {
 		donefld = 0;	/* mark $1... invalid */
 		donerec = 1;
+		recgen++;
 	}
-	t = tostring(s);	/* in case it's self-assign */
-	if (freeable(vp))
-		xfree(vp->sval);
-	vp->tval &= ~NUM;
+	if ((n = strlen(s)) < sizeof(vp->nbuf) && !vp->celem) {	/* keep it in the Cell */
+		memcpy(tmp, s, n+1);	/* in case it's self-assign */
+		if (freeable(vp))
+			xfree(vp->sval);
+		t = memcpy(vp->nbuf, tmp, n+1);
+		vp->tval |= DONTFREE;
+		if (own)
+			free((char *) s);
+	} else {
+		if (own) {	/* shrinks in place, if at all */
+			if ((t = (char *) realloc((char *) s, n+1)) == NULL)
+				t = (char *) s;
+		} else
+			t = tostring(s);	/* in case it's self-assign */
+		svcharge(vp, -1);
+		if (freeable(vp))
+			xfree(vp->sval);
+		vp->tval &= ~DONTFREE;
+	}
+	if (vp == convfmtloc || vp == ofmtloc)
+		lastfmt = NULL;
+	vp->tval &= ~(NUM|CONV);
 	vp->tval |= STR;
-	vp->tval &= ~DONTFREE;
 	   dprintf( ("setsval %p: %s = \"%s (%p) \", t=%o r,f=%d,%d\n", 
 		(void*)vp, NN(vp->nval), t,t, vp->tval, donerec, donefld) );
-	return(vp->sval = t);
+	vp->sval = t;
+	svcharge(vp, 1);
+	return(t);
 }
 
 Awkfloat getfval(Cell *vp)	/* get float val of a Cell */
@@ -351,19 +2364,165 @@ Awkfloat getfval(Cell *vp)	/* get float val of a Cell */
 	else if (isrec(vp) && donerec == 0)
 		recbld();
 	if (!isnum(vp)) {	/* not a number */
-		vp->fval = atof(vp->sval);	/* best guess */
-		if (is_number(vp->sval) && !(vp->tval&CON))
-			vp->tval |= NUM;	/* make NUM only sparingly */
+		if (is_valid_number(vp->sval, &vp->fval)) {
+			if (!(vp->tval&CON))
+				vp->tval |= NUM;	/* make NUM only sparingly */
+		} else
+			vp->fval = atof(vp->sval);	/* best guess */
 	}
 	   dprintf( ("getfval %p: %s = %g, t=%o\n",
 		(void*)vp, NN(vp->nval), vp->fval, vp->tval) );
 	return(vp->fval);
 }
 
+/* itos converts v to decimal in buf, which must hold at least 21 bytes */
+/* (a sign, 19 digits and the \0).  returns the length of the result. */
+
+int itos(char *buf, long long v)
+{
+	char tmp[24], *p = tmp + sizeof(tmp);
+	unsigned long long u = v < 0 ? -(unsigned long long) v : (unsigned long long) v;
+	int n;
+
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u != 0);
+	if (v < 0)
+		*--p = '-';
+	n = tmp + sizeof(tmp) - p;
+	memcpy(buf, p, n);
+	buf[n] = '\0';
+	return n;
+}
+
+static const double p10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* g6fmt formats f exactly as sprintf("%.6g") would, without going */
+/* through stdio.  f is scaled by one exact power of ten; when the */
+/* scaled value is too close to a rounding tie to be sure of the last */
+/* digit it returns -1 and the caller falls back to snprintf. */
+
+static int g6fmt(char *buf, double f)
+{
+	double a = fabs(f), sc, r;
+	int e, k, i, n, d[6];
+	char *p = buf;
+
+	if (!(a > 0) || a > 1e300)	/* 0, inf, nan, or nearly so */
+		return -1;
+	e = (int) floor(log10(a));
+	for (i = 0; i < 2; i++) {
+		k = 5 - e;
+		if (k > 22 || k < -22)
+			return -1;
+		sc = k >= 0 ? a * p10[k] : a / p10[-k];
+		if (sc < 100000)
+			e--;
+		else if (sc >= 1000000)
+			e++;
+		else
+			break;
+	}
+	if (i == 2)
+		return -1;
+	r = floor(sc);
+	if (fabs(sc - r - 0.5) < 1e-7)	/* too close to call */
+		return -1;
+	n = (int) r + (sc - r > 0.5);
+	if (n == 1000000) {	/* rounded up to the next decade */
+		n = 100000;
+		e++;
+	}
+	for (i = 5; i >= 0; i--, n /= 10)
+		d[i] = n % 10;
+	for (n = 6; n > 1 && d[n-1] == 0; n--)	/* %g drops trailing zeros */
+		;
+	if (f < 0)
+		*p++ = '-';
+	if (e >= -4 && e < 6) {
+		if (e < 0) {
+			*p++ = '0';
+			*p++ = '.';
+			for (i = e; i < -1; i++)
+				*p++ = '0';
+			for (i = 0; i < n; i++)
+				*p++ = '0' + d[i];
+		} else {
+			for (i = 0; i <= e; i++)
+				*p++ = '0' + d[i];
+			if (n > e + 1) {
+				*p++ = '.';
+				for ( ; i < n; i++)
+					*p++ = '0' + d[i];
+			}
+		}
+	} else {
+		*p++ = '0' + d[0];
+		if (n > 1) {
+			*p++ = '.';
+			for (i = 1; i < n; i++)
+				*p++ = '0' + d[i];
+		}
+		*p++ = 'e';
+		*p++ = e < 0 ? '-' : '+';
+		if (e < 0)
+			e = -e;
+		if (e >= 100)
+			*p++ = '0' + e / 100;
+		*p++ = '0' + e / 10 % 10;
+		*p++ = '0' + e % 10;
+	}
+	*p = '\0';
+	return p - buf;
+}
+
+/* fmtnum converts f to a string as getsval does: integral values print */
+/* as integers, anything else through fmt (CONVFMT or OFMT).  the result */
+/* goes in buf, which must hold NUMBUFSZ bytes; nothing is allocated. */
+
+char *fmtnum(char *buf, Awkfloat f, const char *fmt)
+{
+	double dtemp;
+
+	if (modf(f, &dtemp) == 0) {	/* it's integral */
+		if (f > -9e18 && f < 9e18 && (f != 0 || !signbit(f))) {
+			itos(buf, (long long) f);
+			return buf;
+		}
+		snprintf(buf, NUMBUFSZ, "%.30g", f);
+	} else if (strcmp(fmt, "%.6g") != 0 || g6fmt(buf, f) < 0)
+		snprintf(buf, NUMBUFSZ, fmt, f);
+	return buf;
+}
+
+static int fmtno(const char *fmt)	/* index of fmt in fmttab */
+{
+	int i;
+
+	if (fmt == lastfmt)
+		return lastno;
+	for (i = 1; i <= nfmt; i++)
+		if (strcmp(fmt, fmttab[i]) == 0)
+			break;
+	if (i > nfmt) {
+		if (nfmt >= NFMT)
+			return NFMT+1;
+		fmttab[i] = tostring(fmt);
+		nfmt = i;
+	}
+	lastfmt = fmt;
+	return lastno = i;
+}
+
 static char *get_str_val(Cell *vp, char **fmt)        /* get string val of a Cell */
 {
-	char s[100];	/* BUG: unchecked */
+	char s[NUMBUFSZ];
 	double dtemp;
+	int n;
 
 	if ((vp->tval & (NUM | STR)) == 0)
 		funnyvar(vp, "read value of");
@@ -371,16 +2530,25 @@ static char *get_str_val(Cell *vp, char **fmt)        /* get string val of a Cel
 		fldbld();
 	else if (isrec(vp) && donerec == 0)
 		recbld();
-	if (isstr(vp) == 0) {
+	if (isstr(vp) == 0 || ((vp->tval & CONV) && vp->cfmt != 0
+	    && vp->cfmt != fmtno(*fmt))) {
+		svcharge(vp, -1);
 		if (freeable(vp))
 			xfree(vp->sval);
-		if (modf(vp->fval, &dtemp) == 0)	/* it's integral */
-			sprintf(s, "%.30g", vp->fval);
-		else
-			sprintf(s, *fmt, vp->fval);
-		vp->sval = tostring(s);
-		vp->tval &= ~DONTFREE;
-		vp->tval |= STR;
+		n = strlen(fmtnum(s, vp->fval, *fmt));
+		if (n < sizeof(vp->nbuf) && !vp->celem) {	/* keep it in the Cell */
+			memcpy(vp->nbuf, s, n+1);
+			vp->sval = vp->nbuf;
+			vp->tval |= DONTFREE;
+		} else {
+			vp->sval = tostring(s);
+			vp->tval &= ~DONTFREE;
+		}
+		vp->tval |= STR|CONV;
+		svcharge(vp, 1);
+		if (vp == convfmtloc || vp == ofmtloc)
+			lastfmt = NULL;
+		vp->cfmt = modf(vp->fval, &dtemp) == 0 ? 0 : fmtno(*fmt);
 	}
 	   dprintf( ("getsval %p: %s = \"%s (%p)\", t=%o\n",
 		(void*)vp, NN(vp->nval), vp->sval, vp->sval, vp->tval) );
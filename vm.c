@@ -0,0 +1,1212 @@
+/****************************************************************
+Copyright (C) Lucent Technologies 1997
+All Rights Reserved
+
+Permission to use, copy, modify, and distribute this software and
+its documentation for any purpose and without fee is hereby
+granted, provided that the above copyright notice appear in all
+copies and that both that the copyright notice and this
+permission notice and warranty disclaimer appear in supporting
+documentation, and that the name Lucent Technologies or any of
+its entities not be used in advertising or publicity pertaining
+to distribution of the software without specific, written prior
+permission.
+
+LUCENT DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS.
+IN NO EVENT SHALL LUCENT OR ANY OF ITS ENTITIES BE LIABLE FOR ANY
+SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER
+IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF
+THIS SOFTWARE.
+****************************************************************/
+
+/*
+ * arithmetic, comparison and assignment in the parse tree are
+ * compiled into code for a small stack machine before the program
+ * runs.  a value on the stack is either a plain number, which needs
+ * no temporary cell, or a Cell (a variable, field, constant or the
+ * result of a subtree the machine can't do, which is run by execute
+ * as before).  numbers are made into cells only when a comparison
+ * has to be done on strings, or when the value leaves the machine.
+ * lists of statements are compiled as a whole: if, while, do and for
+ * become jumps, and other statements are run one at a time by their
+ * procedures in proctab, as execute would.  a compiled list is put in
+ * a CODE node where the list was, and so is the root of an expression
+ * that is run on its own (a pattern, say, or an argument of print),
+ * so the rest of the interpreter doesn't know the difference.
+ */
+
+#define DEBUG
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include "awk.h"
+#include "ytab.h"
+
+#define tempfree(x)	if (istemp(x)) tfree(x); else
+
+extern	Cell	*True, *False;
+extern	Node	*curnode;
+extern	struct	Frame	*frame, *fp;
+
+#define	VMSTACK	32	/* deepest stack a compiled expression may use */
+
+enum {	/* instructions; the order is that of lab[] in vmrun */
+	VEND,	/* done; the value is on top */
+	VNUM,	/* push the number u.f */
+	VCELL,	/* push the cell u.c */
+	VNVAR,	/* push getfval(u.c) */
+	VNF,	/* push NF, splitting the record first */
+	VFLD,	/* replace a value by the field it numbers */
+	VFLDK,	/* push field n */
+	VTONUM,	/* make the top a number */
+	VADD, VSUB, VMUL, VDIV, VMOD, VPOW, VNEG,
+	VREL,	/* compare the top two by relop n */
+	VTRUTH,	/* make the top True or False */
+	VNOT,
+	VJF,	/* pop; jump to n if it isn't true */
+	VJT,	/* pop; jump to n if it is */
+	VJMP,
+	VINCR,	/* ++ or -- (n) on the cell on top */
+	VASGN,	/* top = below it, or top op= below it (n) */
+	VEXEC,	/* push execute(u.p) */
+	VPOP,
+	VNODE,	/* the statement being run is u.p */
+	VSTAT,	/* run the statement u.p; return a jump */
+	VLOOP,	/* another turn of a loop */
+	VNATIVE	/* run u.fn, compiled by --emit-c, on the code after this */
+};
+
+static	Inst	*code;		/* being compiled */
+static	int	ncode, szcode;
+static	int	depth, maxdepth;
+
+static int emit(int op, int n)
+{
+	if (ncode >= szcode) {
+		szcode = szcode ? 2 * szcode : 32;
+		if ((code = (Inst *) realloc(code, szcode * sizeof(Inst))) == NULL)
+			FATAL("out of space compiling expressions");
+	}
+	code[ncode].op = op;
+	code[ncode].n = n;
+	code[ncode].u.p = NULL;
+	return ncode++;
+}
+
+static void push(int k)	/* the stack grows (or shrinks) by k */
+{
+	depth += k;
+	if (depth > maxdepth)
+		maxdepth = depth;
+}
+
+static int iscode(Node *p)	/* can the machine do p itself? */
+{
+	if (p == NULL || isvalue(p))
+		return 0;
+	switch (p->nobj) {
+	case ADD: case MINUS: case MULT: case DIVIDE: case MOD: case POWER: case UMINUS:
+	case LT: case LE: case GT: case GE: case EQ: case NE:
+	case AND: case BOR: case NOT: case CONDEXPR:
+	case PREINCR: case POSTINCR: case PREDECR: case POSTDECR:
+	case ASSIGN: case ADDEQ: case SUBEQ: case MULTEQ: case DIVEQ: case MODEQ: case POWEQ:
+	case INDIRECT: case VARNF:
+		return 1;
+	}
+	return 0;
+}
+
+static int constfld(Node *p)	/* field number of $k for a constant k, else -1 */
+{
+	Cell *x;
+	Awkfloat val;
+
+	p = p->narg[0];
+	if (!isvalue(p) || !((x = (Cell *) p->narg[0])->tval & CON))
+		return -1;
+	val = getfval(x);
+	if ((Awkfloat)INT_MAX < val || val < 0 || ((int) val == 0 && !is_number(getsval(x))))
+		return -1;	/* leave the complaint to indirect() */
+	return (int) val;
+}
+
+static Node *lastrun(Node *p)	/* the node execute would have run last for p */
+{					/* or NULL if that depends */
+	for (;;) {
+		if (isvalue(p))
+			return p;
+		switch (p->nobj) {
+		case ADD: case MINUS: case MULT: case DIVIDE: case MOD: case POWER:
+		case LT: case LE: case GT: case GE: case EQ: case NE:
+			p = p->narg[1];
+			break;
+		case UMINUS: case NOT: case INDIRECT:
+		case PREINCR: case POSTINCR: case PREDECR: case POSTDECR:
+		case ASSIGN: case ADDEQ: case SUBEQ: case MULTEQ: case DIVEQ: case MODEQ: case POWEQ:
+			p = p->narg[0];
+			break;
+		case VARNF:
+			return p;
+		default:
+			return NULL;
+		}
+	}
+}
+
+static void expr(Node *p, int num)	/* code for p; num: leave a number */
+{
+	Cell *x;
+	int i, j, k;
+
+	x = isvalue(p) ? (Cell *) p->narg[0] : NULL;
+	if (x != NULL ? isfld(x) || isrec(x) : !iscode(p)) {	/* for execute */
+		emit(VEXEC, 0);
+		code[ncode-1].u.p = p;
+		push(1);
+		if (num)
+			emit(VTONUM, 0);
+		return;
+	}
+	if (isvalue(p)) {
+		if (num && (x->tval & CON) && (x->tval & (NUM|STR))) {
+			emit(VNUM, 0);
+			code[ncode-1].u.f = getfval(x);
+		} else if (num) {
+			emit(VNVAR, 0);
+			code[ncode-1].u.c = x;
+		} else {
+			emit(VCELL, 0);
+			code[ncode-1].u.c = x;
+		}
+		push(1);
+		return;
+	}
+	switch (p->nobj) {
+	case ADD: case MINUS: case MULT: case DIVIDE: case MOD: case POWER:
+		expr(p->narg[0], 1);
+		expr(p->narg[1], 1);
+		switch (p->nobj) {
+		case ADD:	emit(VADD, 0); break;
+		case MINUS:	emit(VSUB, 0); break;
+		case MULT:	emit(VMUL, 0); break;
+		case DIVIDE:	emit(VDIV, 0); break;
+		case MOD:	emit(VMOD, 0); break;
+		case POWER:	emit(VPOW, 0); break;
+		}
+		code[ncode-1].u.p = lastrun(p);	/* for error messages */
+		push(-1);
+		return;
+	case UMINUS:
+		expr(p->narg[0], 1);
+		emit(VNEG, 0);
+		return;
+	case LT: case LE: case GT: case GE: case EQ: case NE:
+		expr(p->narg[0], 0);
+		expr(p->narg[1], 0);
+		emit(VREL, p->nobj);
+		push(-1);
+		break;
+	case NOT:
+		expr(p->narg[0], 0);
+		emit(VNOT, 0);
+		break;
+	case AND: case BOR:
+		expr(p->narg[0], 0);
+		i = emit(p->nobj == AND ? VJF : VJT, 0);
+		push(-1);
+		expr(p->narg[1], 0);
+		emit(VTRUTH, 0);
+		j = emit(VJMP, 0);
+		k = emit(VCELL, 0);	/* emit may move code */
+		code[i].n = k;
+		code[ncode-1].u.c = p->nobj == AND ? False : True;
+		code[j].n = ncode;
+		break;
+	case CONDEXPR:
+		expr(p->narg[0], 0);
+		i = emit(VJF, 0);
+		push(-1);
+		expr(p->narg[1], num);
+		j = emit(VJMP, 0);
+		push(-1);
+		code[i].n = ncode;
+		expr(p->narg[2], num);
+		code[j].n = ncode;
+		return;
+	case PREINCR: case POSTINCR: case PREDECR: case POSTDECR:
+		expr(p->narg[0], 0);
+		emit(VINCR, p->nobj);
+		break;
+	case ASSIGN: case ADDEQ: case SUBEQ: case MULTEQ: case DIVEQ: case MODEQ: case POWEQ:
+		expr(p->narg[1], 0);	/* the order of assign() */
+		expr(p->narg[0], 0);
+		emit(VASGN, p->nobj);
+		code[ncode-1].u.p = lastrun(p->narg[0]);
+		push(-1);
+		break;
+	case INDIRECT:
+		if ((k = constfld(p)) >= 0) {
+			emit(VFLDK, k);
+			push(1);
+		} else {
+			expr(p->narg[0], 0);
+			emit(VFLD, 0);
+		}
+		break;
+	case VARNF:
+		emit(VNF, 0);
+		code[ncode-1].u.c = (Cell *) p->narg[0];
+		push(1);
+		break;
+	}
+	if (num)
+		emit(VTONUM, 0);
+}
+
+static	Inst	**block;	/* all the code saved, in order, for vmemit */
+static	int	*nblock;
+static	int	nsaved, szsaved;
+
+static Inst *save(void)	/* a copy of the code compiled */
+{
+	Inst *c;
+	int k = aotcode != NULL;	/* room for a VNATIVE in front */
+
+	if ((c = (Inst *) malloc((ncode + k) * sizeof(Inst))) == NULL)
+		FATAL("out of space compiling expressions");
+	memcpy(c + k, code, ncode * sizeof(Inst));
+	if (k) {	/* the same code, compiled to C by --emit-c */
+		if (aotcode[nsaved].fn == NULL || aotcode[nsaved].n != ncode)
+			FATAL("program was compiled by a different bioawk");
+		c->op = VNATIVE;
+		c->u.fn = aotcode[nsaved].fn;
+	}
+	if (nsaved >= szsaved) {
+		szsaved = szsaved ? 2 * szsaved : 16;
+		block = (Inst **) realloc(block, szsaved * sizeof(Inst *));
+		nblock = (int *) realloc(nblock, szsaved * sizeof(int));
+		if (block == NULL || nblock == NULL)
+			FATAL("out of space compiling expressions");
+	}
+	block[nsaved] = c + k;
+	nblock[nsaved++] = ncode;
+	return c;
+}
+
+static void top(Node *p)	/* compile expression p in place if the machine can do it */
+{
+	if (!iscode(p))
+		return;
+	ncode = depth = maxdepth = 0;
+	expr(p, 0);
+	emit(VEND, 0);
+	if (maxdepth > VMSTACK)
+		return;
+	p->nobj = CODE;
+	p->narg[0] = (Node *) save();
+}
+
+static void cond(Node *p)	/* code for a condition */
+{
+	int n = ncode;
+
+	depth = maxdepth = 0;
+	expr(p, 0);
+	if (maxdepth > VMSTACK) {	/* too deep; let execute do it */
+		ncode = n;
+		emit(VEXEC, 0);
+		code[ncode-1].u.p = p;
+	}
+}
+
+typedef struct Loop {	/* jumps to patch at the end of a loop */
+	int	brk;	/* chained through n, ending with -1 */
+	int	cont;
+} Loop;
+
+static void patch(int i, int to)	/* point the chain of jumps at i to to */
+{
+	int j;
+
+	for (; i >= 0; i = j) {
+		j = code[i].n;
+		code[i].n = to;
+	}
+}
+
+static int legal(Node *p)	/* can the statements in list p all be compiled? */
+{
+	for (; p != NULL; p = p->nnext) {
+		if (isvalue(p) || notlegal(p->nobj))
+			return 0;
+		switch (p->nobj) {
+		case IF:
+			if (!legal(p->narg[1]) || !legal(p->narg[2]))
+				return 0;
+			break;
+		case WHILE:
+			if (!legal(p->narg[1]))
+				return 0;
+			break;
+		case DO:
+			if (!legal(p->narg[0]))
+				return 0;
+			break;
+		case FOR:
+			if (!legal(p->narg[0]) || !legal(p->narg[2]) || !legal(p->narg[3]))
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+static void prep(Node *p)	/* compile what list p runs through execute */
+{
+	Node *q;
+
+	for (; p != NULL; p = p->nnext) {
+		switch (p->nobj) {
+		case IF:
+			prep(p->narg[1]);
+			prep(p->narg[2]);
+			break;
+		case WHILE:
+			prep(p->narg[1]);
+			break;
+		case DO:
+			prep(p->narg[0]);
+			break;
+		case FOR:
+			prep(p->narg[0]);
+			prep(p->narg[2]);
+			prep(p->narg[3]);
+			break;
+		case IN:
+			p->narg[2] = vmcompile(p->narg[2]);
+			break;
+		case PRINT: case PRINTF:
+			for (q = p->narg[0]; q != NULL; q = q->nnext)
+				top(q);
+			break;
+		case EXIT: case RETURN:
+			top(p->narg[0]);
+			break;
+		}
+	}
+}
+
+static void stats(Node *p, Loop *lp)	/* code for statement list p */
+{
+	Loop l;
+	int i, j, back, n;
+
+	for (; p != NULL; p = p->nnext) {
+		emit(VNODE, 0);
+		code[ncode-1].u.p = p;
+		switch (p->nobj) {
+		case IF:
+			cond(p->narg[0]);
+			i = emit(VJF, 0);
+			stats(p->narg[1], lp);
+			if (p->narg[2] != NULL) {
+				j = emit(VJMP, 0);
+				code[i].n = ncode;
+				stats(p->narg[2], lp);
+				code[j].n = ncode;
+			} else
+				code[i].n = ncode;
+			break;
+		case WHILE:
+			l.brk = l.cont = -1;
+			back = ncode;
+			cond(p->narg[0]);
+			i = emit(VJF, 0);
+			stats(p->narg[1], &l);
+			patch(l.cont, ncode);
+			emit(VLOOP, 0);
+			emit(VJMP, back);
+			code[i].n = ncode;
+			patch(l.brk, ncode);
+			break;
+		case DO:
+			l.brk = l.cont = -1;
+			back = ncode;
+			stats(p->narg[0], &l);
+			patch(l.cont, ncode);
+			cond(p->narg[1]);
+			i = emit(VJF, 0);
+			emit(VLOOP, 0);
+			emit(VJMP, back);
+			code[i].n = ncode;
+			patch(l.brk, ncode);
+			break;
+		case FOR:
+			stats(p->narg[0], lp);
+			l.brk = l.cont = -1;
+			back = ncode;
+			i = -1;
+			if (p->narg[1] != NULL) {
+				cond(p->narg[1]);
+				i = emit(VJF, 0);
+			}
+			stats(p->narg[3], &l);
+			patch(l.cont, ncode);
+			stats(p->narg[2], lp);
+			emit(VLOOP, 0);
+			emit(VJMP, back);
+			if (i >= 0)
+				code[i].n = ncode;
+			patch(l.brk, ncode);
+			break;
+		case BREAK: case CONTINUE:
+			if (lp == NULL)
+				goto stat;	/* for the loop that runs this code */
+			i = emit(VJMP, -1);
+			if (p->nobj == BREAK) {
+				code[i].n = lp->brk;
+				lp->brk = i;
+			} else {
+				code[i].n = lp->cont;
+				lp->cont = i;
+			}
+			break;
+		case POSTINCR: case POSTDECR:	/* the old value isn't wanted */
+		case PREINCR: case PREDECR:
+		case ASSIGN: case ADDEQ: case SUBEQ: case MULTEQ: case DIVEQ: case MODEQ: case POWEQ:
+			n = ncode;
+			depth = maxdepth = 0;
+			if (p->nobj == POSTINCR || p->nobj == POSTDECR) {
+				expr(p->narg[0], 0);
+				emit(VINCR, p->nobj == POSTINCR ? PREINCR : PREDECR);
+			} else
+				expr(p, 0);
+			emit(VPOP, 0);
+			if (maxdepth <= VMSTACK)
+				break;
+			ncode = n;
+			/* fall through */
+		default:
+		stat:
+			emit(VSTAT, 0);
+			code[ncode-1].u.p = p;
+			break;
+		}
+	}
+}
+
+Node *vmcompile(Node *p)	/* compile statement list p; returns what runs it */
+{
+	Node *x;
+
+	if (p == NULL)
+		return NULL;
+	if (p->nobj == PROGRAM) {
+		p->narg[0] = vmcompile(p->narg[0]);
+		for (x = p->narg[1]; x != NULL; x = x->nnext)
+			if (x->nobj == PASTAT) {
+				top(x->narg[0]);
+				x->narg[1] = vmcompile(x->narg[1]);
+			} else if (x->nobj == PASTAT2) {
+				top(x->narg[0]);
+				top(x->narg[1]);
+				x->narg[2] = vmcompile(x->narg[2]);
+			}
+		p->narg[2] = vmcompile(p->narg[2]);
+		return p;
+	}
+	if (!legal(p))
+		return p;
+	prep(p);
+	ncode = 0;
+	stats(p, NULL);
+	emit(VEND, 1);
+	x = node1(CODE, (Node *) save());
+	x->ntype = NSTAT;
+	x->lineno = p->lineno;
+	return x;
+}
+
+Cell *vmcell(Vslot *s)	/* the value of s as a cell */
+{
+	if (s->c == NULL) {
+		s->c = gettemp();
+		setfval(s->c, s->f);
+	}
+	return s->c;
+}
+
+Cell *vmfield(Cell *x)	/* as in indirect() */
+{
+	Awkfloat val;
+	int m;
+	char *s;
+
+	val = getfval(x);
+	if ((Awkfloat)INT_MAX < val)
+		FATAL("trying to access out of range field %s", x->nval);
+	m = (int) val;
+	if (m == 0 && !is_number(s = getsval(x)))
+		FATAL("illegal field $(%s), name \"%s\"", s, x->nval);
+	tempfree(x);
+	x = fieldadr(m);
+	x->ctype = OCELL;
+	x->csub = CFLD;
+	if (isfld(x) && !donefld)
+		fldbld();
+	else if (isrec(x) && !donerec)
+		recbld();
+	return x;
+}
+
+Cell *vmfldk(int k)	/* field k, as in indirect() */
+{
+	Cell *x;
+
+	x = fieldadr(k);
+	x->ctype = OCELL;
+	x->csub = CFLD;
+	if (isfld(x) && !donefld)
+		fldbld();
+	else if (isrec(x) && !donerec)
+		recbld();
+	return x;
+}
+
+static int strrel(Vslot *a, Vslot *b)	/* relop() on strings */
+{
+	char *s1, *s2;
+
+	s1 = getsval(vmcell(a));
+	s2 = getsval(vmcell(b));
+	return s1 == s2 ? 0 : strcmp(s1, s2);
+}
+
+int vmcmp(Vslot *a, Vslot *b)	/* compare a and b as relop() does; frees both */
+{
+	Cell *x = a->c, *y = b->c;
+	Awkfloat j;
+	int k;
+
+	if ((x == NULL || isnum(x)) && (y == NULL || isnum(y))) {
+		j = (x ? x->fval : a->f) - (y ? y->fval : b->f);
+		k = j<0? -1: (j>0? 1: 0);
+	} else {
+		k = strrel(a, b);
+		x = a->c;	/* a number has a temp Cell now */
+		y = b->c;
+	}
+	if (x != NULL) {
+		tempfree(x);
+	}
+	if (y != NULL) {
+		tempfree(y);
+	}
+	return k;
+}
+
+Cell *vmstat(Node *p)	/* run statement p as execute would; a jump or NULL */
+{
+	Cell *x;
+
+	curnode = p;
+	x = (*proctab[p->nobj-FIRSTTOKEN])(p->narg, p->nobj);
+	if (isfld(x) && !donefld)
+		fldbld();
+	else if (isrec(x) && !donerec)
+		recbld();
+	if (isjump(x))
+		return x;
+	tempfree(x);
+	return NULL;
+}
+
+Cell *vmasgn(int n, Cell *x, Vslot *b, Node *last)	/* as in assign() */
+{
+	Cell *y = b->c;
+	Awkfloat xf, yf;
+	double v;
+
+	if (n == ASSIGN) {
+		if (y == NULL)
+			setfval(x, b->f);
+		else if (x == y && !(x->tval & (FLD|REC)))
+			;
+		else if ((y->tval & (STR|NUM|CONV)) == (STR|NUM)) {
+			setsval(x, getsval(y));
+			x->fval = getfval(y);
+			x->tval |= NUM;
+		}
+		else if (isnum(y))
+			setfval(x, getfval(y));
+		else if (isstr(y))
+			setsval(x, getsval(y));
+		else
+			funnyvar(y, "read value of");
+		if (y != NULL) {
+			tempfree(y);
+		}
+		return x;
+	}
+	xf = GETF(x);
+	yf = y ? GETF(y) : b->f;
+	switch (n) {
+	case ADDEQ:
+		xf += yf;
+		break;
+	case SUBEQ:
+		xf -= yf;
+		break;
+	case MULTEQ:
+		xf *= yf;
+		break;
+	case DIVEQ:
+		if (yf == 0) {
+			curnode = last ? last : curnode;
+			FATAL("division by zero in /=");
+		}
+		xf /= yf;
+		break;
+	case MODEQ:
+		if (yf == 0) {
+			curnode = last ? last : curnode;
+			FATAL("division by zero in %%=");
+		}
+		modf(xf/yf, &v);
+		xf = xf - yf * v;
+		break;
+	case POWEQ:
+		if (yf >= 0 && modf(yf, &v) == 0.0)
+			xf = ipow(xf, (int) yf);
+		else {
+			curnode = last ? last : curnode;
+			xf = errcheck(pow(xf, yf), "pow");
+		}
+		break;
+	}
+	if (y != NULL) {
+		tempfree(y);
+	}
+	SETF(x, xf);
+	return x;
+}
+
+Cell *vmrun(Node **a, int n)	/* run the code in a[0] */
+{
+	Inst *pc = (Inst *) a[0];
+	Vslot st[VMSTACK+1], *sp = st;	/* sp is the top */
+	Cell *x;
+	Awkfloat j;
+	double v;
+	int k;
+
+#ifdef __GNUC__
+	static void *lab[] = {
+		&&L_VEND, &&L_VNUM, &&L_VCELL, &&L_VNVAR, &&L_VNF, &&L_VFLD, &&L_VFLDK,
+		&&L_VTONUM, &&L_VADD, &&L_VSUB, &&L_VMUL, &&L_VDIV, &&L_VMOD, &&L_VPOW,
+		&&L_VNEG, &&L_VREL, &&L_VTRUTH, &&L_VNOT, &&L_VJF, &&L_VJT, &&L_VJMP,
+		&&L_VINCR, &&L_VASGN, &&L_VEXEC, &&L_VPOP, &&L_VNODE, &&L_VSTAT,
+		&&L_VLOOP, &&L_VNATIVE
+	};
+#define	OP(op)		L_##op
+#define	DISPATCH	goto *lab[(++pc)->op]
+#define	JUMPTO(i)	goto *lab[(pc = (Inst *) a[0] + (i))->op]
+	goto *lab[pc->op];
+#else
+#define	OP(op)		case op
+#define	DISPATCH	{ pc++; continue; }
+#define	JUMPTO(i)	{ pc = (Inst *) a[0] + (i); continue; }
+	for (;;) switch (pc->op) {
+#endif
+	OP(VNUM):
+		(++sp)->c = NULL;
+		sp->f = pc->u.f;
+		DISPATCH;
+	OP(VCELL):
+		(++sp)->c = pc->u.c;
+		DISPATCH;
+	OP(VNVAR):
+		(++sp)->c = NULL;
+		x = pc->u.c;
+		sp->f = GETF(x);
+		DISPATCH;
+	OP(VNF):
+		if (donefld == 0)
+			fldbld();
+		(++sp)->c = pc->u.c;
+		DISPATCH;
+	OP(VFLD):
+		sp->c = vmfield(vmcell(sp));
+		DISPATCH;
+	OP(VFLDK):
+		(++sp)->c = vmfldk(pc->n);
+		DISPATCH;
+	OP(VTONUM):
+		if ((x = sp->c) != NULL) {
+			sp->f = GETF(x);
+			sp->c = NULL;
+			tempfree(x);
+		}
+		DISPATCH;
+	OP(VADD):
+		sp--;
+		sp->f += sp[1].f;
+		DISPATCH;
+	OP(VSUB):
+		sp--;
+		sp->f -= sp[1].f;
+		DISPATCH;
+	OP(VMUL):
+		sp--;
+		sp->f *= sp[1].f;
+		DISPATCH;
+	OP(VDIV):
+		sp--;
+		if (sp[1].f == 0) {
+			curnode = pc->u.p ? pc->u.p : curnode;
+			FATAL("division by zero");
+		}
+		sp->f /= sp[1].f;
+		DISPATCH;
+	OP(VMOD):
+		sp--;
+		if ((j = sp[1].f) == 0) {
+			curnode = pc->u.p ? pc->u.p : curnode;
+			FATAL("division by zero in mod");
+		}
+		modf(sp->f/j, &v);
+		sp->f = sp->f - j * v;
+		DISPATCH;
+	OP(VPOW):
+		sp--;
+		if ((j = sp[1].f) >= 0 && modf(j, &v) == 0.0)	/* pos integer exponent */
+			sp->f = ipow(sp->f, (int) j);
+		else {
+			curnode = pc->u.p ? pc->u.p : curnode;
+			sp->f = errcheck(pow(sp->f, j), "pow");
+		}
+		DISPATCH;
+	OP(VNEG):
+		sp->f = -sp->f;
+		DISPATCH;
+	OP(VREL):	/* as in relop() */
+		sp--;
+		if (sp->c == NULL && sp[1].c == NULL) {
+			j = sp->f - sp[1].f;
+			k = j<0? -1: (j>0? 1: 0);
+		} else
+			k = vmcmp(sp, sp+1);
+		switch (pc->n) {
+		case LT:	k = k < 0; break;
+		case LE:	k = k <= 0; break;
+		case NE:	k = k != 0; break;
+		case EQ:	k = k == 0; break;
+		case GE:	k = k >= 0; break;
+		case GT:	k = k > 0; break;
+		}
+		sp->c = k ? True : False;
+		DISPATCH;
+	OP(VTRUTH):
+		k = sp->c != NULL && istrue(sp->c);
+		if (sp->c != NULL) {
+			tempfree(sp->c);
+		}
+		sp->c = k ? True : False;
+		DISPATCH;
+	OP(VNOT):
+		k = sp->c != NULL && istrue(sp->c);
+		if (sp->c != NULL) {
+			tempfree(sp->c);
+		}
+		sp->c = k ? False : True;
+		DISPATCH;
+	OP(VJF):
+		k = sp->c != NULL && istrue(sp->c);
+		if (sp->c != NULL) {
+			tempfree(sp->c);
+		}
+		sp--;
+		if (!k)
+			JUMPTO(pc->n);
+		DISPATCH;
+	OP(VJT):
+		k = sp->c != NULL && istrue(sp->c);
+		if (sp->c != NULL) {
+			tempfree(sp->c);
+		}
+		sp--;
+		if (k)
+			JUMPTO(pc->n);
+		DISPATCH;
+	OP(VJMP):
+		JUMPTO(pc->n);
+	OP(VINCR):
+		x = sp->c;
+		j = GETF(x);
+		k = (pc->n == PREINCR || pc->n == POSTINCR) ? 1 : -1;
+		SETF(x, j + k);
+		if (pc->n == POSTINCR || pc->n == POSTDECR) {
+			tempfree(x);
+			sp->c = NULL;
+			sp->f = j;
+		}
+		DISPATCH;
+	OP(VASGN):
+		sp--;
+		sp->c = vmasgn(pc->n, sp[1].c, sp, pc->u.p);
+		DISPATCH;
+	OP(VEXEC):
+		x = execute(pc->u.p);
+		(++sp)->c = x;
+		DISPATCH;
+	OP(VPOP):
+		if (sp->c != NULL) {
+			tempfree(sp->c);
+		}
+		sp--;
+		DISPATCH;
+	OP(VNODE):
+		curnode = pc->u.p;
+		DISPATCH;
+	OP(VSTAT):
+		if ((x = vmstat(pc->u.p)) != NULL)
+			return x;
+		DISPATCH;
+	OP(VLOOP):
+		if (fp == frame)	/* as loopcheck() in run.c */
+			arraycheck();
+		DISPATCH;
+	OP(VNATIVE):
+		return (*pc->u.fn)(pc + 1);
+	OP(VEND):
+		if (pc->n)	/* the end of a list of statements */
+			return True;
+		return vmcell(sp);
+#ifndef __GNUC__
+	}
+#endif
+}
+
+/*
+ * bioawk --emit-c writes the code for each list out as a C function,
+ * an instruction at a time, with what is known before the program
+ * runs (numbers, field numbers, relops, jumps, and where on the stack
+ * each value is) written in.  the program is parsed and compiled
+ * again when the binary made from that starts, giving the same code;
+ * the cells and nodes it points to are found there, through c.
+ */
+
+static int effect(int op)	/* the change in depth op makes */
+{
+	switch (op) {
+	case VNUM: case VCELL: case VNVAR: case VNF: case VFLDK: case VEXEC:
+		return 1;
+	case VADD: case VSUB: case VMUL: case VDIV: case VMOD: case VPOW:
+	case VREL: case VJF: case VJT: case VASGN: case VPOP:
+		return -1;
+	}
+	return 0;
+}
+
+static int reach(int *d, int i, int k)	/* i is run at depth k; new? */
+{
+	if (d[i] < 0) {
+		d[i] = k;
+		return 1;
+	}
+	if (d[i] != k)
+		FATAL("stack depth %d and %d at instruction %d", d[i], k, i);
+	return 0;
+}
+
+static void emitstr(const char *s)	/* s as a C string */
+{
+	printf("\t\"");
+	for (; *s; s++)
+		if (*s == '\n')
+			printf(s[1] ? "\\n\"\n\t\"" : "\\n");
+		else if (*s == '"' || *s == '\\' || *s == '?')
+			printf("\\%c", *s);
+		else if (isprint((uschar) *s))
+			putchar(*s);
+		else
+			printf("\\%03o", (uschar) *s);
+	printf("\"");
+}
+
+static void emitcur(Inst *c, int i)	/* set curnode for an error, as vmrun does */
+{
+	if (c[i].u.p != NULL)
+		printf("\t\tcurnode = c[%d].u.p;\n", i);
+}
+
+static int numof(Inst *c, int i, char *num, char *test)	/* for emitrel */
+{
+	Cell *x;
+
+	*test = '\0';
+	switch (c[i].op) {
+	case VNUM:
+		if (!isfinite(c[i].u.f))
+			return 0;
+		sprintf(num, "%a", c[i].u.f);
+		return 1;
+	case VCELL:
+		x = c[i].u.c;
+		if ((x->tval & (CON|NUM)) == (CON|NUM) && isfinite(x->fval)) {
+			sprintf(num, "%a", x->fval);	/* a constant number */
+			return 1;
+		}
+		sprintf(num, "c[%d].u.c->fval", i);
+		sprintf(test, "isnum(c[%d].u.c)", i);
+		return 1;
+	}
+	return 0;
+}
+
+static int emitrel(Inst *c, int i, int t, char *target, int n)	/* VREL, and a jump on it */
+{
+	char *rel, a[64], b[64], ta[64], tb[64];
+	int jump;
+
+	switch (c[i].n) {
+	case LT:	rel = "<"; break;
+	case LE:	rel = "<="; break;
+	case NE:	rel = "!="; break;
+	case EQ:	rel = "=="; break;
+	case GE:	rel = ">="; break;
+	default:	rel = ">"; break;
+	}
+	jump = i+1 < n && !target[i+1] && (c[i+1].op == VJF || c[i+1].op == VJT);
+	if (i >= 2 && !target[i-1] && !target[i]	/* both pushed just before */
+	    && numof(c, i-2, a, ta) && numof(c, i-1, b, tb)) {
+		if (*ta || *tb) {
+			printf("\tif (%s%s%s) {\n", ta, *ta && *tb ? " && " : "", tb);
+			printf("\t\tj = %s - %s;\n", a, b);
+			printf("\t\tk = j<0? -1: (j>0? 1: 0);\n");
+			printf("\t} else\n\t\tk = vmcmp(&st[%d], &st[%d]);\n", t-1, t);
+		} else {
+			printf("\tj = %s - %s;\n", a, b);
+			printf("\tk = j<0? -1: (j>0? 1: 0);\n");
+		}
+	} else {
+		printf("\tif (st[%d].c == NULL && st[%d].c == NULL) {\n", t-1, t);
+		printf("\t\tj = st[%d].f - st[%d].f;\n", t-1, t);
+		printf("\t\tk = j<0? -1: (j>0? 1: 0);\n");
+		printf("\t} else\n\t\tk = vmcmp(&st[%d], &st[%d]);\n", t-1, t);
+	}
+	if (jump) {	/* True and False aren't temps: nothing to free */
+		printf("\tif (%s(k %s 0))\n\t\tgoto L%d;\n",
+			c[i+1].op == VJF ? "!" : "", rel, c[i+1].n);
+		return 1;
+	}
+	printf("\tst[%d].c = k %s 0 ? True : False;\n", t-1, rel);
+	return 0;
+}
+
+static void emitcode(int b, Inst *c, int n)	/* function code<b> for c[0..n-1] */
+{
+	int *d, i, t, more, max = 0;
+	char *target;
+	unsigned use = 0;
+	double v;
+
+	d = (int *) malloc(n * sizeof(int));
+	target = (char *) calloc(n, 1);
+	if (d == NULL || target == NULL)
+		FATAL("out of space in emitcode");
+	for (i = 0; i < n; i++)
+		d[i] = -1;
+	d[0] = 0;
+	do {	/* find the depth of the stack at each instruction */
+		more = 0;
+		for (i = 0; i < n; i++) {
+			if (d[i] < 0)
+				continue;
+			t = d[i] + effect(c[i].op);
+			if (t > max)
+				max = t;
+			use |= 1u << c[i].op;
+			if (c[i].op == VJF || c[i].op == VJT || c[i].op == VJMP) {
+				target[c[i].n] = 1;
+				more |= reach(d, c[i].n, t);
+				if (c[i].op == VJMP)
+					continue;
+			}
+			if (c[i].op != VEND)
+				more |= reach(d, i+1, t);
+		}
+	} while (more);
+
+	printf("\nstatic Cell *code%d(Inst *c)\n{\n", b);
+	if (max > 0)
+		printf("\tVslot st[%d];\n", max + 1);
+	if (use & (1u<<VNVAR | 1u<<VTONUM | 1u<<VINCR | 1u<<VSTAT))
+		printf("\tCell *x;\n");
+	if (use & (1u<<VMOD | 1u<<VPOW | 1u<<VREL | 1u<<VINCR))
+		printf("\tAwkfloat j;\n");
+	if (use & (1u<<VMOD | 1u<<VPOW))
+		printf("\tdouble v;\n");
+	if (use & (1u<<VREL | 1u<<VTRUTH | 1u<<VNOT | 1u<<VJF | 1u<<VJT))
+		printf("\tint k;\n");
+	printf("\n");
+	for (i = 0; i < n; i++) {
+		if ((t = d[i]) < 0)
+			continue;	/* never run */
+		if (target[i])
+			printf("L%d:\n", i);
+		switch (c[i].op) {
+		case VNUM:
+			printf("\tst[%d].c = NULL;\n", t+1);
+			if (isfinite(c[i].u.f))
+				printf("\tst[%d].f = %a;\n", t+1, c[i].u.f);
+			else
+				printf("\tst[%d].f = c[%d].u.f;\n", t+1, i);
+			break;
+		case VCELL:
+			printf("\tst[%d].c = c[%d].u.c;\n", t+1, i);
+			break;
+		case VNVAR:
+			printf("\tx = c[%d].u.c;\n", i);
+			printf("\tst[%d].c = NULL;\n", t+1);
+			printf("\tst[%d].f = GETF(x);\n", t+1);
+			break;
+		case VNF:
+			printf("\tif (donefld == 0)\n\t\tfldbld();\n");
+			printf("\tst[%d].c = c[%d].u.c;\n", t+1, i);
+			break;
+		case VFLD:
+			printf("\tst[%d].c = vmfield(vmcell(&st[%d]));\n", t, t);
+			break;
+		case VFLDK:
+			printf("\tst[%d].c = vmfldk(%d);\n", t+1, c[i].n);
+			break;
+		case VTONUM:
+			printf("\tif ((x = st[%d].c) != NULL) {\n", t);
+			printf("\t\tst[%d].f = GETF(x);\n", t);
+			printf("\t\tst[%d].c = NULL;\n", t);
+			printf("\t\ttempfree(x);\n\t}\n");
+			break;
+		case VADD: case VSUB: case VMUL:
+			printf("\tst[%d].f %c= st[%d].f;\n", t-1,
+				c[i].op == VADD ? '+' : c[i].op == VSUB ? '-' : '*', t);
+			break;
+		case VDIV:
+			printf("\tif (st[%d].f == 0) {\n", t);
+			emitcur(c, i);
+			printf("\t\tFATAL(\"division by zero\");\n\t}\n");
+			printf("\tst[%d].f /= st[%d].f;\n", t-1, t);
+			break;
+		case VMOD:
+			printf("\tif ((j = st[%d].f) == 0) {\n", t);
+			emitcur(c, i);
+			printf("\t\tFATAL(\"division by zero in mod\");\n\t}\n");
+			printf("\tmodf(st[%d].f/j, &v);\n", t-1);
+			printf("\tst[%d].f = st[%d].f - j * v;\n", t-1, t-1);
+			break;
+		case VPOW:
+			if (c[i-1].op == VNUM && !target[i] && (v = c[i-1].u.f) >= 0
+			    && v <= INT_MAX && v == (int) v) {	/* x^k: k known */
+				printf("\tst[%d].f = ipow(st[%d].f, %d);\n", t-1, t-1, (int) v);
+				break;
+			}
+			printf("\tif ((j = st[%d].f) >= 0 && modf(j, &v) == 0.0)\n", t);
+			printf("\t\tst[%d].f = ipow(st[%d].f, (int) j);\n", t-1, t-1);
+			printf("\telse {\n");
+			emitcur(c, i);
+			printf("\t\tst[%d].f = errcheck(pow(st[%d].f, j), \"pow\");\n\t}\n", t-1, t-1);
+			break;
+		case VNEG:
+			printf("\tst[%d].f = -st[%d].f;\n", t, t);
+			break;
+		case VREL:
+			if (emitrel(c, i, t, target, n))
+				i++;	/* the jump is done */
+			break;
+		case VTRUTH: case VNOT: case VJF: case VJT:
+			printf("\tk = st[%d].c != NULL && istrue(st[%d].c);\n", t, t);
+			printf("\tif (st[%d].c != NULL) {\n\t\ttempfree(st[%d].c);\n\t}\n", t, t);
+			if (c[i].op == VTRUTH)
+				printf("\tst[%d].c = k ? True : False;\n", t);
+			else if (c[i].op == VNOT)
+				printf("\tst[%d].c = k ? False : True;\n", t);
+			else
+				printf("\tif (%sk)\n\t\tgoto L%d;\n", c[i].op == VJF ? "!" : "", c[i].n);
+			break;
+		case VJMP:
+			printf("\tgoto L%d;\n", c[i].n);
+			break;
+		case VINCR:
+			printf("\tx = st[%d].c;\n", t);
+			printf("\tj = GETF(x);\n");
+			printf("\tSETF(x, j %c 1);\n", c[i].n == PREINCR || c[i].n == POSTINCR ? '+' : '-');
+			if (c[i].n == POSTINCR || c[i].n == POSTDECR) {
+				printf("\ttempfree(x);\n");
+				printf("\tst[%d].c = NULL;\n", t);
+				printf("\tst[%d].f = j;\n", t);
+			}
+			break;
+		case VASGN:
+			printf("\tst[%d].c = vmasgn(%d, st[%d].c, &st[%d], c[%d].u.p);\n",
+				t-1, c[i].n, t, t-1, i);
+			break;
+		case VEXEC:
+			printf("\tst[%d].c = execute(c[%d].u.p);\n", t+1, i);
+			break;
+		case VPOP:
+			printf("\tif (st[%d].c != NULL) {\n\t\ttempfree(st[%d].c);\n\t}\n", t, t);
+			break;
+		case VNODE:
+			printf("\tcurnode = c[%d].u.p;\t/* line %d */\n", i, c[i].u.p->lineno);
+			break;
+		case VSTAT:
+			printf("\tif ((x = vmstat(c[%d].u.p)) != NULL)\n\t\treturn x;\n", i);
+			break;
+		case VLOOP:
+			printf("\tif (fp == frame)\n\t\tarraycheck();\n");
+			break;
+		case VEND:
+			if (c[i].n)
+				printf("\treturn True;\n");
+			else
+				printf("\treturn vmcell(&st[%d]);\n", t);
+			break;
+		default:
+			FATAL("can't emit instruction %d", c[i].op);
+		}
+	}
+	printf("}\n");
+	free(d);
+	free(target);
+}
+
+void vmemit(Node *a, char *prog)	/* write program a, whose text is prog, as C */
+{
+	int i;
+
+	vmcompile(a);
+	printf("/*\n * made by bioawk --emit-c.  to build it, where bioawk was built:\n");
+	printf(" *\tmake libbioawk.a\n");
+	printf(" *\tcc -O2 -I. -o prog prog.c libbioawk.a -lm -lz -lpthread\n */\n\n");
+	printf("#include <stdio.h>\n#include <stdlib.h>\n#include <math.h>\n");
+	printf("#include \"awk.h\"\n#include \"ytab.h\"\n\n");
+	printf("#define tempfree(x)\tif (istemp(x)) tfree(x); else\n\n");
+	printf("extern\tCell\t*True, *False;\n");
+	printf("extern\tNode\t*curnode;\n");
+	printf("extern\tstruct\tFrame\t*frame, *fp;\n\n");
+	printf("char\t*aotprog =\n");
+	emitstr(prog);
+	printf(";\n");
+	for (i = 0; i < nsaved; i++)
+		emitcode(i, block[i], nblock[i]);
+	printf("\nstatic Ncode code[] = {\n");
+	for (i = 0; i < nsaved; i++)
+		printf("\t{ code%d, %d },\n", i, nblock[i]);
+	printf("\t{ NULL, 0 }\n};\n\nNcode\t*aotcode = code;\n");
+}